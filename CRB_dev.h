@@ -13,6 +13,10 @@ typedef enum {
     CRB_BOOLEAN_VALUE,
     CRB_NATIVE_POINTER_VALUE,
     CRB_NULL_VALUE,
+    CRB_ARRAY_VALUE,
+    CRB_MAP_VALUE,
+    CRB_TYPED_ARRAY_VALUE,
+    CRB_RECORD_VALUE,
 } CRB_ValueType;
 
 typedef enum {
@@ -20,15 +24,27 @@ typedef enum {
     CRB_TRUE,
 } CRB_Boolean;
 
-typedef struct {
-    int         ref_count;
-    char       *string;
-    CRB_Boolean is_literal;
+// 字符串. 视图 (parent != NULL) 引用父字符串从某个偏移开始的 length 个字符,
+// 此时 string 不以 '\0' 结尾, 需要 C 字符串时使用 crb_string_to_c 实体化
+typedef struct CRB_String_tag {
+    int                    ref_count;
+    char                  *string;
+    int                    length;
+    int                    capacity;     // 自己拥有的缓冲区可容纳的字符数, 不含结尾的 '\0'
+    struct CRB_String_tag *parent;       // 视图所引用的父字符串, 持有其引用计数
+    CRB_Boolean            is_literal;
+    CRB_Boolean            is_interned;  // 是否登记在解释器的驻留表中
+    CRB_Boolean            is_scratch;   // 分配在临时区中, 随语句结束回收, 不参与引用计数
+    unsigned int           hash;         // 缓存的哈希值, 0 表示尚未计算
+    struct CRB_String_tag *intern_next;  // 驻留表的桶内链表
+    CRB_Boolean            marked;       // 回收器的标记位
+    struct CRB_String_tag *gc_next;      // 回收器管理的对象链表
 } CRB_String;
 
 // 内置指针信息, 就使用场景来看, 记录了对应的库名
 typedef struct {
-    const char *name;
+    const char                 *name;
+    struct CRB_NativeMethod_tag *method;  // 方法表, 以 name 为 NULL 的项结尾, 没有方法时为 NULL
 } CRB_NativePointerInfo;
 
 typedef struct {
@@ -36,8 +52,51 @@ typedef struct {
     void                  *pointer;
 } CRB_NativePointer;
 
+// 数组, 映射等容器的公共头部, 回收器经由它管理不同类型的容器
+typedef struct CRB_Object_tag {
+    CRB_ValueType          type;
+    int                    ref_count;
+    CRB_Boolean            marked;   // 回收器的标记位
+    struct CRB_Object_tag *gc_next;  // 回收器管理的容器链表
+} CRB_Object;
+
+// 数组. 元素连续存放在 element 中, 容量不足时按倍数增长
+typedef struct CRB_Array_tag {
+    CRB_Object             header;
+    int                    size;
+    int                    capacity;
+    struct CRB_Value_tag  *element;
+} CRB_Array;
+
+// 映射. 以 int 或字符串为键的开放寻址 (Robin Hood) 哈希表, 槽的布局见 crowbar.h
+typedef struct CRB_Map_tag {
+    CRB_Object               header;
+    int                      count;
+    int                      capacity;  // 槽数, 总是 2 的幂, 0 表示还没有分配
+    struct CRB_MapEntry_tag *entry;
+} CRB_Map;
+
+// 数值数组的元素类型
+typedef enum {
+    CRB_INT_ELEMENT,
+    CRB_DOUBLE_ELEMENT,
+} CRB_ElementType;
+
+// 数值数组. 元素不装箱, 直接以机器数值连续存放, 长度在创建时确定
+typedef struct CRB_TypedArray_tag {
+    CRB_Object      header;
+    CRB_ElementType element_type;
+    int             size;
+    union {
+        int    *int_element;
+        double *double_element;
+    } u;
+} CRB_TypedArray;
+
+typedef struct CRB_Record_tag CRB_Record;
+
 // 值类型
-typedef struct {
+typedef struct CRB_Value_tag {
     CRB_ValueType type;
     union {
         CRB_Boolean       boolean_value;
@@ -45,9 +104,20 @@ typedef struct {
         double            double_value;
         CRB_String       *string_value;
         CRB_NativePointer native_pointer;
+        CRB_Array        *array_value;
+        CRB_Map          *map_value;
+        CRB_TypedArray   *typed_array_value;
+        CRB_Record       *record_value;
     } u;
 } CRB_Value;
 
+// 记录. 字段布局由共享的形状描述, 字段值按形状中的顺序连续存放在头部之后
+struct CRB_Record_tag {
+    CRB_Object                  header;
+    struct CRB_RecordShape_tag *shape;
+    CRB_Value                   field[];
+};
+
 // 变量
 typedef struct Value_tag {
     const char       *name;
@@ -71,6 +141,15 @@ typedef CRB_Value (*CRB_NativeFunctionProc)(CRB_Interpreter *interpreter,
                                             int              argc,
                                             CRB_Value       *args);
 
+/**
+ * 内置指针类型的方法, 由 receiver.name(...) 调用.
+ * args[0] 是接收者本身, 之后依次是实参, argc 包括接收者
+ */
+typedef struct CRB_NativeMethod_tag {
+    const char             *name;
+    CRB_NativeFunctionProc  proc;
+} CRB_NativeMethod;
+
 /**
  * 添加内置函数
  */
@@ -78,4 +157,49 @@ void CRB_add_native_function(CRB_Interpreter        *interpreter,
                              const char             *name,
                              CRB_NativeFunctionProc  proc);
 
+/**
+ * 设置是否把语法树放在 mmap 映射, 尽量使用大页的存储器中 (默认关闭).
+ * 语法树在执行期间被反复遍历, 节点很多时可以减少 TLB 缺失,
+ * 代价是至少占用一个大页 (2MB), MAP_HUGETLB 成功时占用系统预留的大页.
+ * 必须在 CRB_compile 之前调用.
+ */
+void CRB_set_mapped_storage(CRB_Interpreter *interpreter,
+                            CRB_Boolean      enabled);
+
+/**
+ * 设置是否在创建字符串时自动驻留 (默认关闭).
+ * 开启后内容相同的运行时字符串共享同一个 CRB_String, 相等比较退化为指针比较.
+ */
+void CRB_set_string_interning(CRB_Interpreter *interpreter,
+                              CRB_Boolean      enabled);
+
+/**
+ * 设置是否使用标记-清除回收器管理运行时字符串 (默认关闭, 使用引用计数).
+ * 必须在 CRB_interpret 之前调用.
+ */
+void CRB_set_gc(CRB_Interpreter *interpreter,
+                CRB_Boolean      enabled);
+
+/**
+ * 设置回收器在一个安全点上工作的时间上限 (纳秒), 0 表示不限制 (默认).
+ * 有上限时标记和清除阶段都被分成多段, 分散到之后的安全点上执行,
+ * 大容器的元素也可以分在多段中扫描. 只有根 (变量和临时值) 的扫描不分段.
+ */
+void CRB_set_gc_max_pause(CRB_Interpreter *interpreter,
+                          long             max_pause_ns);
+
+// 回收器的统计信息, 时间单位为纳秒
+typedef struct {
+    long   cycle_count;     // 完成的回收轮数
+    long   pause_count;     // 执行过回收工作的安全点数
+    long   total_pause_ns;
+    long   max_pause_ns;
+    long   last_pause_ns;
+    long   freed_count;     // 回收的对象 (字符串和容器) 数
+    size_t live_bytes;      // 上一轮结束时存活的字节数
+} CRB_GCStats;
+
+void CRB_get_gc_stats(CRB_Interpreter *interpreter,
+                      CRB_GCStats     *stats);
+
 #endif // CRB_DEV_H
@@ -12,6 +12,38 @@ typedef struct MEM_Controller_tag *MEM_Controller;
 typedef void (*MEM_ErrorHandler)(FILE *, const char *, int, const char *);
 typedef struct MEM_Storage_tag *MEM_Storage;
 
+// The huge page size assumed by mapped storages.
+#define MEM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// A saved allocation point of a storage, see MEM_storage_mark.
+// The fields are private to the storage module.
+typedef struct {
+    void *page;
+    void *large_page;
+    int   use_cell_num;
+} MEM_StorageMark;
+
+// Counters kept by every controller, see MEM_get_stats.
+// Byte counts are those of the underlying blocks, so DEBUG headers are included.
+typedef struct {
+    size_t live_bytes;        // bytes in blocks not yet freed
+    size_t peak_bytes;        // maximum of live_bytes so far
+    long   alloc_count;       // number of malloc/strdup calls, and reallocs of NULL
+    long   free_count;        // number of blocks freed
+    int    storage_page_num;  // storage pages held, including pages kept for reuse
+    size_t mapped_bytes;      // bytes of mmap-backed storage pages
+} MEM_Stats;
+
+// Space usage of a storage, see MEM_storage_stats.
+typedef struct {
+    int    page_num;        // pages in use, including the current one
+    int    large_page_num;  // large allocations, one page each
+    int    free_page_num;   // pages kept for reuse after a release
+    size_t used_bytes;      // bytes handed out from the pages in use
+    size_t wasted_bytes;    // unusable tail space of the retired pages
+    size_t large_bytes;     // bytes held by large allocations
+} MEM_StorageStats;
+
 extern MEM_Controller mem_default_controller;
 
 // MEM_CONTROLLER is the customiszing controller.
@@ -27,15 +59,24 @@ void *MEM_malloc_func(MEM_Controller controller, const char *filename, int line,
 void *MEM_realloc_func(MEM_Controller controller, const char *filename, int line, void *ptr, size_t size);
 char *MEM_strdup_func(MEM_Controller controller, const char *filename, int line, const char *str);
 MEM_Storage MEM_open_storage_func(MEM_Controller controller, const char *filename, int line, int page_size);
+MEM_Storage MEM_open_mapped_storage_func(MEM_Controller controller, const char *filename, int line, int page_size);
 void *MEM_storage_malloc_func(MEM_Controller controller, const char *filename, int line, MEM_Storage storage, size_t size);
 void MEM_dispose_storage_func(MEM_Controller controller, MEM_Storage storage);
+MEM_StorageMark MEM_storage_mark_func(MEM_Storage storage);
+void MEM_storage_release_to_mark_func(MEM_Controller controller, MEM_Storage storage, MEM_StorageMark mark);
+void MEM_storage_stats_func(MEM_Storage storage, MEM_StorageStats *stats);
 
 void MEM_free_func(MEM_Controller controller, void *ptr);
+void MEM_get_stats_func(MEM_Controller controller, MEM_Stats *stats);
 void MEM_set_error_handler(MEM_Controller controller, MEM_ErrorHandler handler);
 void MEM_set_fail_mode(MEM_Controller controller, MEM_FailMode mode);
 void MEM_dump_blocks_func(MEM_Controller controller, FILE *fp);
 void MEM_check_blocks_func(MEM_Controller controller, const char *filename, int line, void *p);
 void MEM_check_all_blocks_func(MEM_Controller controller, const char *filename, int line);
+void MEM_set_check_rate_func(MEM_Controller controller, int blocks_per_alloc);
+void MEM_enable_profile_func(MEM_Controller controller, size_t sample_bytes);
+void MEM_set_profile_context_func(MEM_Controller controller, const int *context_line);
+void MEM_dump_profile_func(MEM_Controller controller, FILE *fp);
 
 #define MEM_malloc(size)\
     MEM_malloc_func(CURRENT_MEM_CONTROLLER, __FILE__, __LINE__, size)
@@ -45,12 +86,28 @@ void MEM_check_all_blocks_func(MEM_Controller controller, const char *filename,
     MEM_strdup_func(CURRENT_MEM_CONTROLLER, __FILE__, __LINE__, str)
 #define MEM_open_storage(page_size)\
     MEM_open_storage_func(CURRENT_MEM_CONTROLLER, __FILE__, __LINE__, page_size)
+#define MEM_open_mapped_storage(page_size)\
+    MEM_open_mapped_storage_func(CURRENT_MEM_CONTROLLER, __FILE__, __LINE__, page_size)
 #define MEM_storage_malloc(storage, size)\
     MEM_storage_malloc_func(CURRENT_MEM_CONTROLLER, __FILE__, __LINE__, storage, size)
 #define MEM_dispose_storage(storage)\
     MEM_dispose_storage_func(CURRENT_MEM_CONTROLLER, storage)
+#define MEM_storage_mark(storage)\
+    MEM_storage_mark_func(storage)
+#define MEM_storage_release_to_mark(storage, mark)\
+    MEM_storage_release_to_mark_func(CURRENT_MEM_CONTROLLER, storage, mark)
+#define MEM_storage_stats(storage, stats)\
+    MEM_storage_stats_func(storage, stats)
 #define MEM_free(ptr)\
     MEM_free_func(CURRENT_MEM_CONTROLLER, ptr)
+#define MEM_get_stats(stats)\
+    MEM_get_stats_func(CURRENT_MEM_CONTROLLER, stats)
+#define MEM_enable_profile(sample_bytes)\
+    MEM_enable_profile_func(CURRENT_MEM_CONTROLLER, sample_bytes)
+#define MEM_set_profile_context(context_line)\
+    MEM_set_profile_context_func(CURRENT_MEM_CONTROLLER, context_line)
+#define MEM_dump_profile(fp)\
+    MEM_dump_profile_func(CURRENT_MEM_CONTROLLER, fp)
 
 #ifdef DEBUG
 #define MEM_dump_blocks(fp)\
@@ -59,10 +116,13 @@ void MEM_check_all_blocks_func(MEM_Controller controller, const char *filename,
     MEM_check_blocks_func(CURRENT_MEM_CONTROLLER, __FILE__, __LINE__, p)
 #define MEM_check_all_blocks()\
     MEM_check_all_blocks_func(CURRENT_MEM_CONTROLLER, __FILE__, __LINE__)
+#define MEM_set_check_rate(blocks_per_alloc)\
+    MEM_set_check_rate_func(CURRENT_MEM_CONTROLLER, blocks_per_alloc)
 #else // DEBUG
 #define MEM_dump_blocks(fp)
 #define MEM_check_block(p)
 #define MEM_check_all_blocks()
+#define MEM_set_check_rate(blocks_per_alloc)
 #endif // DEBUG
 
 #endif // MEM_H
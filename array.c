@@ -0,0 +1,101 @@
+/**
+ * array.c
+ * 数组的分配, 增长与释放.
+ *
+ * 元素保存在连续的 CRB_Value 缓冲区中, 下标访问和赋值都是 O(1).
+ * 追加时容量不足则按倍数增长, 所以 n 次追加的总拷贝量是 O(n), 均摊 O(1).
+ */
+
+#include "crowbar.h"
+#include "DBG.h"
+#include <string.h>
+
+// 空数组第一次追加时的容量
+#define ARRAY_INIT_CAPACITY (8)
+
+// 容量不足时的增长倍数
+#define ARRAY_GROWTH_FACTOR (2)
+
+CRB_Array *
+crb_create_array(CRB_Interpreter *interpreter, int size)
+{
+    CRB_Array *array = MEM_malloc(sizeof(CRB_Array));
+    array->header.type = CRB_ARRAY_VALUE;
+    array->header.ref_count = 1;
+    array->header.marked = CRB_FALSE;  // 由回收器登记时设置
+    array->header.gc_next = NULL;
+    array->size = size;
+    array->capacity = size;
+    array->element = (size > 0) ? MEM_malloc(sizeof(CRB_Value) * size) : NULL;
+    // 填写元素期间可能经过安全点, 回收器会遍历所有元素
+    for (int i = 0; i < size; i++) {
+        array->element[i].type = CRB_NULL_VALUE;
+    }
+    if (interpreter->gc.enabled) {
+        crb_gc_register_container(interpreter, &array->header, crb_array_bytes(array));
+    }
+    return array;
+}
+
+void
+crb_array_add(CRB_Interpreter *interpreter, CRB_Array *array, CRB_Value *value)
+{
+    if (array->size == array->capacity) {
+        int new_capacity = (array->capacity == 0) ?
+                           ARRAY_INIT_CAPACITY : array->capacity * ARRAY_GROWTH_FACTOR;
+        array->element = MEM_realloc(array->element, sizeof(CRB_Value) * new_capacity);
+        if (interpreter->gc.enabled) {
+            crb_gc_add_bytes(interpreter, sizeof(CRB_Value) * (new_capacity - array->capacity));
+        }
+        array->capacity = new_capacity;
+    }
+    array->element[array->size++] = *value;
+    crb_refer_value(value);
+    crb_gc_write_barrier(interpreter, value);
+}
+
+CRB_Value *
+crb_array_element(CRB_Array *array, int index)
+{
+    if (index < 0 || index >= array->size) {
+        crb_runtime_error(crb_get_current_interpreter()->current_line_number,
+                          "array index %d out of range (size %d)", index, array->size);
+    }
+    return &array->element[index];
+}
+
+void
+crb_refer_array(CRB_Array *array)
+{
+    if (!crb_get_current_interpreter()->gc.enabled) {
+        array->header.ref_count++;
+    }
+}
+
+void
+crb_dispose_array(CRB_Array *array)
+{
+    MEM_free(array->element);
+    MEM_free(array);
+}
+
+void
+crb_release_array(CRB_Array *array)
+{
+    if (crb_get_current_interpreter()->gc.enabled) {
+        return;
+    }
+
+    array->header.ref_count--;
+    DBG_assert(array->header.ref_count >= 0, "ref count < 0");
+
+    if (array->header.ref_count == 0) {
+        crb_release_container(&array->header);
+    }
+}
+
+size_t
+crb_array_bytes(CRB_Array *array)
+{
+    return sizeof(CRB_Array) + sizeof(CRB_Value) * array->capacity;
+}
@@ -3,11 +3,14 @@
 
 #include "crowbar.h"
 #include <stdlib.h>
+#include <string.h>
 
 void
 crb_function_define(const char *identifier, ParameterList *parameter_list, Block *block)
 {
-    if (crb_search_function(identifier) != NULL) {
+    // 内置函数可以被脚本中的同名函数覆盖, 只检查脚本中的函数
+    FunctionDefinition *defined = crb_search_function(identifier);
+    if (defined != NULL && defined->type == CROWBAR_FUNCTION_DEFINITION) {
         fprintf(stderr, "Line %d: redefined of function %s\n",
                 crb_get_current_interpreter()->current_line_number, identifier);
         exit(1);
@@ -22,11 +25,48 @@ crb_function_define(const char *identifier, ParameterList *parameter_list, Block
     function->type = CROWBAR_FUNCTION_DEFINITION;
     function->u.crowbar_f.block = block;
     function->u.crowbar_f.parameter = parameter_list;
+    function->u.crowbar_f.inline_state = INLINE_NOT_ANALYZED;
+    function->u.crowbar_f.inline_body = NULL;
 
     function->next = interpreter->function_list;
     interpreter->function_list = function;
 }
 
+static CRB_Boolean
+is_literal_expression(Expression *expr)
+{
+    return expr->type == INT_EXPRESSION || expr->type == DOUBLE_EXPRESSION
+           || expr->type == STRING_EXPRESSION || expr->type == BOOLEAN_EXPRESSION
+           || expr->type == NULL_EXPRESSION;
+}
+
+void
+crb_constant_define(const char *identifier, Expression *value)
+{
+    CRB_Interpreter *interpreter = crb_get_current_interpreter();
+
+    if (crb_search_constant(identifier) != NULL) {
+        fprintf(stderr, "Line %d: redefined of constant %s\n",
+                interpreter->current_line_number, identifier);
+        exit(1);
+    }
+
+    // 初始值只能引用之前定义的常量, 折叠后必须是字面量
+    crb_fold_expression(value);
+    if (!is_literal_expression(value)) {
+        fprintf(stderr, "Line %d: value of constant %s is not a constant expression\n",
+                value->line_number, identifier);
+        exit(1);
+    }
+
+    ConstantDefinition *constant = crb_malloc(sizeof(ConstantDefinition));
+    constant->name = identifier;
+    constant->value = value;
+
+    constant->next = interpreter->constant_list;
+    interpreter->constant_list = constant;
+}
+
 ParameterList *
 crb_create_parameter(const char *name)
 {
@@ -75,6 +115,83 @@ crb_chain_argument_list(ArgumentList *list, Expression *expression)
     }
 }
 
+ExpressionList *
+crb_create_expression_list(Expression *expression)
+{
+    ExpressionList *list = crb_malloc(sizeof(ExpressionList));
+    list->expression = expression;
+    list->next = NULL;
+    return list;
+}
+
+ExpressionList *
+crb_chain_expression_list(ExpressionList *list, Expression *expression)
+{
+    ExpressionList *new_node = crb_create_expression_list(expression);
+    if (list == NULL) {
+        return new_node;
+    }
+    else {
+        ExpressionList *curr;
+        for (curr = list; curr->next != NULL; curr = curr->next) ;
+        curr->next = new_node;
+        return list;
+    }
+}
+
+KeyValueList *
+crb_create_key_value_list(Expression *key, Expression *value)
+{
+    KeyValueList *list = crb_malloc(sizeof(KeyValueList));
+    list->key = key;
+    list->value = value;
+    list->next = NULL;
+    return list;
+}
+
+KeyValueList *
+crb_chain_key_value_list(KeyValueList *list, Expression *key, Expression *value)
+{
+    KeyValueList *new_node = crb_create_key_value_list(key, value);
+    if (list == NULL) {
+        return new_node;
+    }
+    else {
+        KeyValueList *curr;
+        for (curr = list; curr->next != NULL; curr = curr->next) ;
+        curr->next = new_node;
+        return list;
+    }
+}
+
+FieldInitList *
+crb_create_field_init_list(const char *name, Expression *value)
+{
+    FieldInitList *list = crb_malloc(sizeof(FieldInitList));
+    list->name = name;
+    list->value = value;
+    list->next = NULL;
+    return list;
+}
+
+FieldInitList *
+crb_chain_field_init_list(FieldInitList *list, const char *name, Expression *value)
+{
+    FieldInitList *new_node = crb_create_field_init_list(name, value);
+    FieldInitList *curr;
+    for (curr = list; ; curr = curr->next) {
+        if (!strcmp(curr->name, name)) {
+            fprintf(stderr, "Line %d: duplicate field %s\n", value->line_number, name);
+            exit(1);
+        }
+        if (curr->next == NULL) {
+            break;
+        }
+    }
+    curr->next = new_node;
+    return list;
+}
+
 // 创建 Statement 链表结点, 将 statement 封装
 StatementList *
 crb_create_statement_list(Statement *statement)
@@ -109,15 +226,55 @@ crb_alloc_expression(ExpressionType type)
     Expression *expr = crb_malloc(sizeof(Expression));
     expr->type = type;
     expr->line_number = crb_get_current_interpreter()->current_line_number;
+    expr->has_side_effect = CRB_FALSE;
+    expr->is_temporary = CRB_FALSE;
     return expr;
 }
 
+static void
+check_left_value(Expression *left_value)
+{
+    if (left_value->type != IDENTIFIER_EXPRESSION && left_value->type != INDEX_EXPRESSION
+            && left_value->type != FIELD_EXPRESSION) {
+        fprintf(stderr, "Line %d: invalid left value\n", left_value->line_number);
+        exit(1);
+    }
+}
+
 Expression *
 crb_create_assign_expression(Expression *left_value, Expression *operand)
 {
+    check_left_value(left_value);
+
     Expression *exp = crb_alloc_expression(ASSIGN_EXPRESSION);
-    exp->u.identifier = left_value->u.identifier;
+    exp->u.assign_expression.left = left_value;
+    exp->u.assign_expression.operand = operand;
+    exp->has_side_effect = CRB_TRUE;
+    return exp;
+}
+
+// operator 是 ADD_ASSIGN_EXPRESSION 等复合赋值类型
+Expression *
+crb_create_compound_assign_expression(ExpressionType operator, Expression *left_value, Expression *operand)
+{
+    check_left_value(left_value);
+
+    Expression *exp = crb_alloc_expression(operator);
+    exp->u.assign_expression.left = left_value;
     exp->u.assign_expression.operand = operand;
+    exp->has_side_effect = CRB_TRUE;
+    return exp;
+}
+
+// operator 是 INCREMENT_EXPRESSION 或 DECREMENT_EXPRESSION
+Expression *
+crb_create_inc_dec_expression(ExpressionType operator, Expression *operand)
+{
+    check_left_value(operand);
+
+    Expression *exp = crb_alloc_expression(operator);
+    exp->u.inc_dec = operand;
+    exp->has_side_effect = CRB_TRUE;
     return exp;
 }
 
@@ -127,6 +284,7 @@ crb_create_binary_expression(ExpressionType operator, Expression *left, Expressi
     Expression *exp = crb_alloc_expression(operator);
     exp->u.binary_expression.left = left;
     exp->u.binary_expression.right = right;
+    exp->has_side_effect = left->has_side_effect || right->has_side_effect;
     return exp;
 }
 
@@ -135,6 +293,7 @@ crb_create_minus_expression(Expression *expression)
 {
     Expression *exp = crb_alloc_expression(MINUS_EXPRESSION);
     exp->u.minus_expression = expression;
+    exp->has_side_effect = expression->has_side_effect;
     return exp;
 }
 
@@ -144,6 +303,20 @@ crb_create_function_call_expression(const char *identifier, ArgumentList *argume
     Expression *expression = crb_alloc_expression(FUNCTION_CALL_EXPRESSION);
     expression->u.function_call_expression.identifier= identifier;
     expression->u.function_call_expression.argument = argument;
+    expression->has_side_effect = CRB_TRUE;
+    return expression;
+}
+
+Expression *
+crb_create_method_call_expression(Expression *receiver, const char *identifier, ArgumentList *argument)
+{
+    Expression *expression = crb_alloc_expression(METHOD_CALL_EXPRESSION);
+    expression->u.method_call_expression.receiver = receiver;
+    expression->u.method_call_expression.identifier = identifier;
+    expression->u.method_call_expression.argument = argument;
+    expression->u.method_call_expression.cached_info = NULL;
+    expression->u.method_call_expression.cached_proc = NULL;
+    expression->has_side_effect = CRB_TRUE;
     return expression;
 }
 
@@ -170,6 +343,79 @@ crb_create_null_expression()
     return expression;
 }
 
+Expression *
+crb_create_array_expression(ExpressionList *list)
+{
+    Expression *expression = crb_alloc_expression(ARRAY_EXPRESSION);
+    expression->u.array_literal = list;
+    for (ExpressionList *pos = list; pos != NULL; pos = pos->next) {
+        if (pos->expression->has_side_effect) {
+            expression->has_side_effect = CRB_TRUE;
+        }
+    }
+    return expression;
+}
+
+Expression *
+crb_create_index_expression(Expression *array, Expression *index)
+{
+    Expression *expression = crb_alloc_expression(INDEX_EXPRESSION);
+    expression->u.index_expression.array = array;
+    expression->u.index_expression.index = index;
+    expression->has_side_effect = array->has_side_effect || index->has_side_effect;
+    return expression;
+}
+
+Expression *
+crb_create_map_expression(KeyValueList *list)
+{
+    Expression *expression = crb_alloc_expression(MAP_EXPRESSION);
+    expression->u.map_literal = list;
+    for (KeyValueList *pos = list; pos != NULL; pos = pos->next) {
+        if (pos->key->has_side_effect || pos->value->has_side_effect) {
+            expression->has_side_effect = CRB_TRUE;
+        }
+    }
+    return expression;
+}
+
+// 记录字面量的形状由字段名的顺序决定, 在这里一次确定
+Expression *
+crb_create_record_expression(FieldInitList *list)
+{
+    Expression *expression = crb_alloc_expression(RECORD_EXPRESSION);
+    int field_count = 0;
+    for (FieldInitList *pos = list; pos != NULL; pos = pos->next) {
+        field_count++;
+    }
+
+    const char **field_name = MEM_malloc(sizeof(const char *) * field_count);
+    int i = 0;
+    for (FieldInitList *pos = list; pos != NULL; pos = pos->next) {
+        field_name[i++] = pos->name;
+        if (pos->value->has_side_effect) {
+            expression->has_side_effect = CRB_TRUE;
+        }
+    }
+    expression->u.record_literal.field = list;
+    expression->u.record_literal.shape = crb_search_shape(crb_get_current_interpreter(),
+                                                          field_count, field_name);
+    MEM_free(field_name);
+    return expression;
+}
+
+Expression *
+crb_create_field_expression(Expression *record, const char *name)
+{
+    Expression *expression = crb_alloc_expression(FIELD_EXPRESSION);
+    expression->u.field_expression.record = record;
+    expression->u.field_expression.name = name;
+    expression->u.field_expression.cached_shape = NULL;
+    expression->u.field_expression.cached_index = 0;
+    expression->has_side_effect = record->has_side_effect;
+    return expression;
+}
+
 static Statement *
 alloc_statement(StatementType type)
 {
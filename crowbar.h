@@ -7,6 +7,7 @@
 #include "CRB_dev.h"
 
 #define LINE_BUF_SIZE 1024
+#define INLINE_MAX_SLOT 8  // 内联函数的形参与局部变量总数的上限
 #define min(a,b) ((a) < (b) ? (a) : (b))
 #define max(a,b) ((a) > (b) ? (a) : (b))
 
@@ -17,19 +18,72 @@
 typedef struct Expression_tag         Expression;
 typedef struct StatementList_tag      StatementList;
 typedef struct FunctionDefinition_tag FunctionDefinition;
+typedef struct ConstantDefinition_tag ConstantDefinition;
 typedef struct ArgumentList_tag       ArgumentList;
+typedef struct ExpressionList_tag     ExpressionList;
+typedef struct KeyValueList_tag       KeyValueList;
+typedef struct CRB_MapEntry_tag       MapEntry;
+typedef struct CRB_RecordShape_tag    RecordShape;
+typedef struct FieldInitList_tag      FieldInitList;
+typedef struct InlineAssignList_tag   InlineAssignList;
 typedef struct ParameterList_tag      ParameterList;
 typedef struct IdentifierList_tag     IdentifierList;
 typedef struct Elsif_tag              Elsif;
+typedef union  StringChunk_tag        StringChunk;
+typedef struct LocalEnvironment_tag   LocalEnvironment;
+
+// 字符串驻留表, 弱引用: 不持有字符串的引用计数,
+// 字符串被释放时从表中摘除
+typedef struct {
+    CRB_String **bucket;
+    int          bucket_num;
+    int          count;
+} InternTable;
+
+// 标记-清除回收器的状态, 只在开启回收器时使用
+typedef struct {
+    CRB_Boolean       enabled;
+    CRB_Boolean       black;               // 本轮中表示"已标记"的标记位取值, 每轮翻转
+    CRB_String       *object_list;         // 由回收器管理的所有字符串, 经 gc_next 串起
+    CRB_Object       *container_list;      // 由回收器管理的所有容器, 经 gc_next 串起
+    CRB_String      **sweep_pos;           // 清除阶段的进度, 为 NULL 时不在清除阶段
+    CRB_Object      **container_sweep_pos; // 字符串清除完后接着清除容器
+    size_t            sweep_live_bytes;    // 本轮清除中已统计的存活字节数
+    size_t            allocated_bytes;     // 本轮开始以来分配的字节数
+    size_t            threshold;           // allocated_bytes 超过它时在下一个安全点开始新的一轮
+    long              max_pause_ns;        // 每个安全点上回收工作的时间上限, 0 表示不限制
+    CRB_Value        *root;                // 临时值的根栈
+    int               root_num;
+    int               root_capacity;
+    LocalEnvironment *env_top;             // 正在执行的函数的运行环境, 经 caller 串起
+    CRB_Boolean       marking;             // 是否在标记阶段
+    CRB_Object      **gray;                // 已标记但元素还没有扫描的容器
+    int               gray_num;
+    int               gray_capacity;
+    CRB_Object       *scan_object;         // 正在扫描的容器, 扫描可以在元素之间中断
+    int               scan_index;          // scan_object 中下一个要扫描的元素 (映射是槽)
+    CRB_GCStats       stats;
+} GarbageCollector;
 
 // 解释器
 struct CRB_Interpreter_tag {
     MEM_Storage         interpreter_storage;
     MEM_Storage         execute_storage;
+    MEM_Storage         scratch_storage;  // 不逃逸的临时字符串, 每个语句的表达式求值后回退
     Variable           *variable;
     FunctionDefinition *function_list;
     StatementList      *statement_list;
     int                 current_line_number;
+    StringChunk        *string_free_list;  // CRB_String 的 slab 空闲链表
+    InternTable         intern_table;
+    CRB_Boolean         intern_on_create;  // 创建字符串时是否自动驻留
+    CRB_Boolean         mapped_storage;    // 语法树是否放在大页映射的存储器中
+    GarbageCollector    gc;
+    RecordShape        *shape_list;  // 所有记录形状, 与解释器同生命周期
+    ConstantDefinition *constant_list;  // const 定义的编译期常量
+    CRB_Value          *inline_frame;  // 正在求值的内联函数体的槽位
+    CRB_Object         *release_list;  // 引用计数降为 0, 等待释放元素的容器, 经 gc_next 串起
+    CRB_Boolean         releasing;     // 是否正在逐个释放 release_list 中的容器
 };
 
 /**
@@ -92,12 +146,26 @@ typedef enum {
     MINUS_EXPRESSION,
     FUNCTION_CALL_EXPRESSION,
     NULL_EXPRESSION,
+    ARRAY_EXPRESSION,
+    INDEX_EXPRESSION,
+    MAP_EXPRESSION,
+    ADD_ASSIGN_EXPRESSION,
+    SUB_ASSIGN_EXPRESSION,
+    MUL_ASSIGN_EXPRESSION,
+    DIV_ASSIGN_EXPRESSION,
+    INCREMENT_EXPRESSION,
+    DECREMENT_EXPRESSION,
+    METHOD_CALL_EXPRESSION,
+    RECORD_EXPRESSION,
+    FIELD_EXPRESSION,
+    INLINE_CALL_EXPRESSION,
+    SLOT_EXPRESSION,
     EXPRESSION_TYPE_COUNT,
 } ExpressionType;
 
-// 赋值表达式
+// 赋值表达式和复合赋值表达式 (+= 等), 左值是标识符或者下标表达式
 typedef struct {
-    const char *variable;
+    Expression *left;
     Expression *operand;
 } AssignExpression;
 
@@ -107,16 +175,86 @@ typedef struct {
     Expression *right;
 } BinaryExpression;
 
+// 下标表达式 array[index]
+typedef struct {
+    Expression *array;
+    Expression *index;
+} IndexExpression;
+
+// 表达式链表, 数组字面量的元素
+struct ExpressionList_tag {
+    Expression     *expression;
+    ExpressionList *next;
+};
+
+// 键值对链表, 映射字面量的元素
+struct KeyValueList_tag {
+    Expression   *key;
+    Expression   *value;
+    KeyValueList *next;
+};
+
+// 字段初始化链表, 记录字面量 {.name = value, ...} 的元素
+struct FieldInitList_tag {
+    const char    *name;
+    Expression    *value;
+    FieldInitList *next;
+};
+
+// 记录字面量, 形状在构造语法树时确定
+typedef struct {
+    FieldInitList *field;
+    RecordShape   *shape;
+} RecordExpression;
+
+// 字段访问 record.name.
+// 每个访问点缓存最近一次见到的形状和字段的下标, 形状相同时直接按下标访问
+typedef struct {
+    Expression  *record;
+    const char  *name;
+    RecordShape *cached_shape;
+    int          cached_index;
+} FieldExpression;
+
 // 函数调用表达式
 typedef struct {
     const char   *identifier;
     ArgumentList *argument;
 } FunctionCallExpression;
 
+// 方法调用表达式 receiver.identifier(argument).
+// 每个调用点缓存最近一次解析到的接收者类型和方法, 类型不变时不再查找方法表
+typedef struct {
+    Expression             *receiver;
+    const char             *identifier;
+    ArgumentList           *argument;
+    CRB_NativePointerInfo  *cached_info;
+    CRB_NativeFunctionProc  cached_proc;
+} MethodCallExpression;
+
+// 内联函数体中局部变量的赋值链表, 按顺序执行
+struct InlineAssignList_tag {
+    int               slot;
+    Expression       *value;
+    InlineAssignList *next;
+};
+
+// 内联的函数调用.
+// 形参和局部变量改名为槽位编号, 实参依次存入槽位, 执行局部变量的赋值后求值 result
+typedef struct {
+    const char       *identifier;  // 被内联的函数名
+    ArgumentList     *argument;
+    int               slot_count;
+    InlineAssignList *assign;
+    Expression       *result;
+} InlineCallExpression;
+
 // 表达式
 struct Expression_tag {
     ExpressionType type;
     int line_number;
+    CRB_Boolean has_side_effect;  // 求值是否可能修改变量 (赋值或者函数调用)
+    CRB_Boolean is_temporary;     // 结果只被父结点读取, 字符串结果可以分配在临时区
     union {
         const char            *identifier;
         char                  *string_value;
@@ -127,6 +265,15 @@ struct Expression_tag {
         BinaryExpression       binary_expression;
         Expression            *minus_expression;
         FunctionCallExpression function_call_expression;
+        MethodCallExpression   method_call_expression;
+        RecordExpression       record_literal;
+        FieldExpression        field_expression;
+        ExpressionList        *array_literal;
+        IndexExpression        index_expression;
+        KeyValueList          *map_literal;
+        Expression            *inc_dec;  // ++ 和 -- 的操作数, 是一个左值
+        InlineCallExpression   inline_call_expression;
+        int                    slot;  // 内联函数体中的形参或局部变量
     } u;
 };
 
@@ -226,6 +373,13 @@ typedef enum {
     NATIVE_FUNCTION_DEFINITION,   // crowbar 解释器内置的函数
 } FunctionDefinitionType;
 
+// 函数的内联分析状态
+typedef enum {
+    INLINE_NOT_ANALYZED,
+    INLINE_ANALYZING,  // 正在展开函数体中的调用, 此时遇到对它的调用说明是递归
+    INLINE_ANALYZED,
+} InlineState;
+
 // 函数, 链表结构
 // TODO 添加对内置函数的支持
 struct FunctionDefinition_tag {
@@ -236,6 +390,8 @@ struct FunctionDefinition_tag {
         struct {
             ParameterList *parameter;
             Block         *block;
+            InlineState    inline_state;
+            Expression    *inline_body;  // 可以内联时是调用点展开用的模板, 见 inline.c
         } crowbar_f;
         struct {
             CRB_NativeFunctionProc proc;
@@ -243,6 +399,14 @@ struct FunctionDefinition_tag {
     } u;
 };
 
+// 编译期常量, 链表结构.
+// value 是折叠后的字面量, 引用常量的标识符在编译完成后被替换成它的拷贝
+struct ConstantDefinition_tag {
+    const char         *name;
+    Expression         *value;
+    ConstantDefinition *next;
+};
+
 
 /**
  * 下面是构造语法树所需要的函数, 主要在 yacc 文件中调用
@@ -251,6 +415,9 @@ struct FunctionDefinition_tag {
 void
 crb_function_define(const char *name, ParameterList *parameter_list, Block *block);
 
+void
+crb_constant_define(const char *name, Expression *value);
+
 StatementList *
 crb_create_statement_list(Statement *statement);
 
@@ -269,12 +436,30 @@ crb_create_argument_list(Expression *expression);
 ArgumentList *
 crb_chain_argument_list(ArgumentList *list, Expression *expression);
 
+ExpressionList *
+crb_create_expression_list(Expression *expression);
+
+ExpressionList *
+crb_chain_expression_list(ExpressionList *list, Expression *expression);
+
+KeyValueList *
+crb_create_key_value_list(Expression *key, Expression *value);
+
+KeyValueList *
+crb_chain_key_value_list(KeyValueList *list, Expression *key, Expression *value);
+
 Expression *
 crb_alloc_expression(ExpressionType type);
 
 Expression *
 crb_create_assign_expression(Expression *left_value, Expression *operand);
 
+Expression *
+crb_create_compound_assign_expression(ExpressionType operator, Expression *left_value, Expression *operand);
+
+Expression *
+crb_create_inc_dec_expression(ExpressionType operator, Expression *operand);
+
 Expression *
 crb_create_binary_expression(ExpressionType operator, Expression *left, Expression *right);
 
@@ -284,6 +469,21 @@ crb_create_minus_expression(Expression *expression);
 Expression *
 crb_create_function_call_expression(const char *identifier, ArgumentList *argument);
 
+Expression *
+crb_create_method_call_expression(Expression *receiver, const char *identifier, ArgumentList *argument);
+
+FieldInitList *
+crb_create_field_init_list(const char *name, Expression *value);
+
+FieldInitList *
+crb_chain_field_init_list(FieldInitList *list, const char *name, Expression *value);
+
+Expression *
+crb_create_record_expression(FieldInitList *list);
+
+Expression *
+crb_create_field_expression(Expression *record, const char *name);
+
 Expression *
 crb_create_identifier_expression(const char *identifier);
 
@@ -293,6 +493,15 @@ crb_create_boolean_expression(CRB_Boolean value);
 Expression *
 crb_create_null_expression();
 
+Expression *
+crb_create_array_expression(ExpressionList *list);
+
+Expression *
+crb_create_index_expression(Expression *array, Expression *index);
+
+Expression *
+crb_create_map_expression(KeyValueList *list);
+
 IdentifierList *
 crb_create_global_identifier(const char *name);
 
@@ -355,6 +564,44 @@ FunctionDefinition *crb_search_function(const char *name);
 // 从顶层作用域搜索全局变量
 Variable *crb_search_global(CRB_Interpreter *interpreter, const char *name);
 
+// 报告运行时错误并结束程序
+void crb_runtime_error(int line_number, const char *fmt, ...);
+
+
+/**
+ * 逃逸分析 (escape.c): 找出结果只被父结点读取的表达式, 设置 is_temporary.
+ * 在编译完成后调用
+ */
+void crb_analyze_escape(CRB_Interpreter *interpreter);
+
+
+/**
+ * 常量折叠 (fold.c): 把常量替换成字面量, 计算操作数都是字面量的表达式,
+ * 删除条件恒定的分支. 在编译完成后, 逃逸分析之前调用
+ */
+void crb_fold_constants(CRB_Interpreter *interpreter);
+
+// 折叠一个表达式, 结果仍在原结点中
+void crb_fold_expression(Expression *expr);
+
+// 搜索常量 <name>, 没找到时返回 NULL
+ConstantDefinition *crb_search_constant(const char *name);
+
+
+/**
+ * 函数内联 (inline.c): 在调用点展开小的非递归函数.
+ * 在常量折叠之后, 逃逸分析之前调用, 需要内置函数已经登记
+ */
+void crb_inline_functions(CRB_Interpreter *interpreter);
+
+
+/**
+ * 与 locale 无关的数值解析, 解析 str 的前 len 个字符.
+ * 整个范围是合法的数值时返回 CRB_TRUE 并写入 result
+ */
+CRB_Boolean crb_parse_int(const char *str, int len, int *result);
+CRB_Boolean crb_parse_double(const char *str, int len, double *result);
+
 
 /**
  * 与内置函数和变量有关的函数
@@ -399,10 +646,11 @@ struct GlobalVariableRef_tag {
 };
 
 // 相当于符号表的存在
-typedef struct {
+struct LocalEnvironment_tag {
     Variable          *variable;         // 局部变量
     GlobalVariableRef *global_variable;  // 全局变量
-} LocalEnvironment;
+    LocalEnvironment  *caller;           // 调用者的运行环境, 回收器由此找到所有的根
+};
 
 // 遍历执行语句块的语句
 StatementResult crb_execute_statement_list(CRB_Interpreter  *interpreter,
@@ -420,12 +668,229 @@ CRB_String *crb_literal_to_crb_string(char *str);
 // 构造非字面字符串变量, C字符串在引用计数为0时同字符串变量一同释放
 CRB_String *crb_create_crb_string(char *str);
 
+// 构造长度为 len 的非字面字符串变量, 字符内容 (含结尾的 '\0') 由调用者填写.
+// 短字符串与头部一同分配, 不再单独申请缓冲区
+CRB_String *crb_alloc_crb_string(size_t len);
+
+// 构造非字面字符串变量, 拷贝 C 字符串 str 的内容
+CRB_String *crb_copy_crb_string(const char *str);
+
+// 在临时区中构造长度为 len 的字符串, 字符内容由调用者填写.
+// 它在当前语句的表达式求值结束时回收, 引用计数操作对它无效
+CRB_String *crb_alloc_scratch_string(CRB_Interpreter *interpreter, size_t len);
+
+// 构造 parent 从 offset 开始长度为 length 的子串.
+// 较长的子串是共享父字符串缓冲区的视图, 短子串直接拷贝到内联缓冲区
+CRB_String *crb_create_string_view(CRB_String *parent, int offset, int length);
+
+// 返回以 '\0' 结尾的字符内容, 视图会在此时实体化并释放父字符串
+const char *crb_string_to_c(CRB_String *str);
+
+// 在 str 末尾原地追加 chars 开始的 len 个字符.
+// 只有引用计数为 1 的普通堆字符串可以原地修改, 否则返回 CRB_FALSE 且不改变 str
+CRB_Boolean crb_append_string_in_place(CRB_String *str, const char *chars, int len);
+
+// 按字典序比较两个字符串, 返回值含义同 strcmp
+int crb_compare_string(CRB_String *left, CRB_String *right);
+
+// 在 str 中从 from 开始查找 pattern 第一次出现的位置, 找不到时返回 -1
+int crb_search_string(CRB_String *str, int from, CRB_String *pattern);
+
+// 计算并缓存字符串的哈希值
+unsigned int crb_string_hash(CRB_String *str);
+
+// 驻留字符串: 返回内容相同的规范 CRB_String.
+// 消耗 str 的一个引用, 返回值带有一个新的引用
+CRB_String *crb_intern_string(CRB_String *str);
+
+// 如果解释器开启了创建时驻留, 则驻留 str, 否则原样返回
+CRB_String *crb_auto_intern_string(CRB_String *str);
+
 // 增加字符串变量的引用计数
 void crb_refer_string(CRB_String *str);
 
 // 减少字符串变量的引用计数, 如果引用计数为0, 释放变量
 void crb_release_string(CRB_String *str);
 
+// 立即释放字符串本身, 不处理引用计数和父字符串, 供回收器清除时使用
+void crb_dispose_string(CRB_String *str);
+
+// 字符串占用的字节数, 包括 slab 块和它自己拥有的缓冲区
+size_t crb_string_bytes(CRB_String *str);
+
+// 值为字符串或容器时增减其引用计数
+void crb_refer_value(CRB_Value *value);
+void crb_release_value(CRB_Value *value);
+
+// 引用计数降为 0 的容器交给它释放元素并回收, 嵌套的容器逐个释放而不递归
+void crb_release_container(CRB_Object *container);
+
+
+/**
+ * 数组 (array.c) 和映射 (map.c).
+ * 容器与字符串一样使用引用计数, 开启回收器后由回收器管理.
+ * 引用计数无法回收循环引用的容器, 回收器可以.
+ */
+
+// 构造长度为 size 的数组, 元素初始化为 null, 返回的数组带有一个引用
+CRB_Array *crb_create_array(CRB_Interpreter *interpreter, int size);
+
+// 在末尾追加 value, 数组持有它的一个新的引用
+void crb_array_add(CRB_Interpreter *interpreter, CRB_Array *array, CRB_Value *value);
+
+// 返回下标为 index 的元素的地址, 越界时报告运行时错误
+CRB_Value *crb_array_element(CRB_Array *array, int index);
+
+void crb_refer_array(CRB_Array *array);
+void crb_release_array(CRB_Array *array);
+
+// 立即释放数组本身, 不处理元素, 供回收器清除时使用
+void crb_dispose_array(CRB_Array *array);
+
+// 数组占用的字节数
+size_t crb_array_bytes(CRB_Array *array);
+
+// 映射的槽. distance 是到理想槽的探测距离加 1, 0 表示空槽.
+// Robin Hood 插入保证同一条探测链上 distance 不会突然变小很多,
+// 查找时遇到 distance 小于当前探测距离的槽就可以断定键不存在
+struct CRB_MapEntry_tag {
+    CRB_Value    key;
+    CRB_Value    value;
+    unsigned int hash;
+    int          distance;
+};
+
+// 构造空映射, 返回的映射带有一个引用
+CRB_Map *crb_create_map(CRB_Interpreter *interpreter);
+
+// 查找 key, 不存在时返回 NULL. 键必须是 int 或字符串, 否则报告运行时错误
+CRB_Value *crb_map_get(CRB_Map *map, CRB_Value *key);
+
+// 设置 key 对应的值, 映射持有键和值的新的引用
+void crb_map_put(CRB_Interpreter *interpreter, CRB_Map *map, CRB_Value *key, CRB_Value *value);
+
+// 删除 key, 返回键是否存在
+CRB_Boolean crb_map_remove(CRB_Map *map, CRB_Value *key);
+
+void crb_refer_map(CRB_Map *map);
+void crb_release_map(CRB_Map *map);
+
+// 立即释放映射本身, 不处理键和值, 供回收器清除时使用
+void crb_dispose_map(CRB_Map *map);
+
+// 映射占用的字节数
+size_t crb_map_bytes(CRB_Map *map);
+
+/**
+ * 数值数组 (typed_array.c).
+ * 元素不含引用, 回收器只需要管理数组本身
+ */
+
+// 构造长度为 size, 元素全为 0 的数值数组, 返回的数组带有一个引用
+CRB_TypedArray *crb_create_typed_array(CRB_Interpreter *interpreter, CRB_ElementType element_type, int size);
+
+// 读写下标为 index 的元素, 越界或者类型不符时报告运行时错误.
+// int 可以写入 double 数组, double 不能写入 int 数组
+CRB_Value crb_typed_array_get(CRB_TypedArray *array, int index);
+void crb_typed_array_set(CRB_TypedArray *array, int index, CRB_Value *value);
+
+void crb_refer_typed_array(CRB_TypedArray *array);
+void crb_release_typed_array(CRB_TypedArray *array);
+void crb_dispose_typed_array(CRB_TypedArray *array);
+size_t crb_typed_array_bytes(CRB_TypedArray *array);
+
+/**
+ * 记录 (record.c).
+ * 形状是字段名的有序列表, 字段名与顺序都相同的记录共享同一个形状,
+ * 所以形状指针相同就意味着字段布局相同, 字段访问点可以按形状缓存字段的下标.
+ */
+struct CRB_RecordShape_tag {
+    int          field_count;
+    const char **field_name;
+    RecordShape *next;  // 解释器的形状链表
+};
+
+// 返回字段名依次为 field_name 的形状, 不存在时新建. field_name 的内容会被拷贝
+RecordShape *crb_search_shape(CRB_Interpreter *interpreter, int field_count, const char **field_name);
+
+// 返回字段 name 在形状中的下标, 没有这个字段时返回 -1
+int crb_shape_field_index(RecordShape *shape, const char *name);
+
+// 构造形状为 shape 的记录, 字段初始化为 null, 返回的记录带有一个引用
+CRB_Record *crb_create_record(CRB_Interpreter *interpreter, RecordShape *shape);
+
+void crb_refer_record(CRB_Record *record);
+void crb_release_record(CRB_Record *record);
+void crb_dispose_record(CRB_Record *record);
+size_t crb_record_bytes(CRB_Record *record);
+
+/**
+ * 数值数组的批量运算内核 (numeric_kernel.c), 首次使用时按 CPU 特性选择实现.
+ * int 运算与解释器的整数运算一样按 32 位回绕.
+ * 向量实现改变了 double 累加的顺序, 结果可能与逐个累加有舍入误差.
+ * min/max 要求 n > 0
+ */
+typedef struct {
+    int    (*sum_int)(const int *p, int n);
+    double (*sum_double)(const double *p, int n);
+    int    (*min_int)(const int *p, int n);
+    double (*min_double)(const double *p, int n);
+    int    (*max_int)(const int *p, int n);
+    double (*max_double)(const double *p, int n);
+    int    (*dot_int)(const int *a, const int *b, int n);
+    double (*dot_double)(const double *a, const double *b, int n);
+    void   (*scale_int)(int *p, int n, int k);
+    void   (*scale_double)(double *p, int n, double k);
+    void   (*add_int)(int *dest, const int *src, int n);
+    void   (*add_double)(double *dest, const double *src, int n);
+    void   (*fill_int)(int *p, int n, int v);
+    void   (*fill_double)(double *p, int n, double v);
+} NumericKernels;
+
+const NumericKernels *crb_numeric_kernels();
+
+// 容器的文本表示 (format.c): 数组为 (e1, e2, ...), 映射为 {k1: v1, ...}.
+// 返回带有一个引用的新字符串
+CRB_String *crb_container_to_string(CRB_Value *value);
+
+
+/**
+ * 标记-清除回收器 (gc.c).
+ * 开启后回收器管理所有运行时字符串, 引用计数操作都变为空操作.
+ * 根: 全局变量, 运行环境栈中的局部变量, 以及根栈中的临时值.
+ * 回收只发生在语句边界的安全点, 所以只有跨越函数调用存活的临时值需要压入根栈.
+ * 清除阶段按时间片分散到多个安全点上执行.
+ */
+
+// 登记新建的字符串, bytes 计入分配量
+void crb_gc_register_string(CRB_Interpreter *interpreter, CRB_String *str, size_t bytes);
+
+// 登记新建的容器, bytes 计入分配量
+void crb_gc_register_container(CRB_Interpreter *interpreter, CRB_Object *container, size_t bytes);
+
+// 字符串追加了独立的缓冲区时计入分配量
+void crb_gc_add_bytes(CRB_Interpreter *interpreter, size_t bytes);
+
+// 压入临时值, 返回压入前的栈顶, 用于 crb_gc_pop_root 恢复
+int crb_gc_push_root(CRB_Interpreter *interpreter, CRB_Value *value);
+void crb_gc_pop_root(CRB_Interpreter *interpreter, int top);
+
+// 函数调用时登记/注销运行环境
+void crb_gc_push_environment(CRB_Interpreter *interpreter, LocalEnvironment *env);
+void crb_gc_pop_environment(CRB_Interpreter *interpreter, LocalEnvironment *env);
+
+// 安全点: 继续未完成的标记或清除, 分配量超过阈值时开始新的一轮
+void crb_gc_safe_point(CRB_Interpreter *interpreter);
+
+// 立即执行一轮完整的回收, 不受暂停时间上限的约束
+void crb_gc_collect(CRB_Interpreter *interpreter);
+
+// 从弱引用的驻留表中重新取得 str 时调用, 防止它在本轮清除中被回收
+void crb_gc_revive_string(CRB_Interpreter *interpreter, CRB_String *str);
+
+// 写屏障: 把值存入数组, 映射或记录后调用, 标记阶段中把白色的值涂灰
+void crb_gc_write_barrier(CRB_Interpreter *interpreter, CRB_Value *value);
+
 /**
  * 默认内置函数定义
  */
@@ -433,4 +898,116 @@ CRB_Value crb_native_print(CRB_Interpreter *interpreter,
                            int              argc,
                            CRB_Value       *argv);
 
+CRB_Value crb_native_intern(CRB_Interpreter *interpreter,
+                            int              argc,
+                            CRB_Value       *argv);
+
+CRB_Value crb_native_substr(CRB_Interpreter *interpreter,
+                            int              argc,
+                            CRB_Value       *argv);
+
+CRB_Value crb_native_trim(CRB_Interpreter *interpreter,
+                          int              argc,
+                          CRB_Value       *argv);
+
+CRB_Value crb_native_split(CRB_Interpreter *interpreter,
+                           int              argc,
+                           CRB_Value       *argv);
+
+CRB_Value crb_native_find(CRB_Interpreter *interpreter,
+                          int              argc,
+                          CRB_Value       *argv);
+
+CRB_Value crb_native_count(CRB_Interpreter *interpreter,
+                           int              argc,
+                           CRB_Value       *argv);
+
+CRB_Value crb_native_replace(CRB_Interpreter *interpreter,
+                             int              argc,
+                             CRB_Value       *argv);
+
+CRB_Value crb_native_starts_with(CRB_Interpreter *interpreter,
+                                 int              argc,
+                                 CRB_Value       *argv);
+
+CRB_Value crb_native_parse_int(CRB_Interpreter *interpreter,
+                               int              argc,
+                               CRB_Value       *argv);
+
+CRB_Value crb_native_parse_double(CRB_Interpreter *interpreter,
+                                  int              argc,
+                                  CRB_Value       *argv);
+
+CRB_Value crb_native_mem_stats(CRB_Interpreter *interpreter,
+                               int              argc,
+                               CRB_Value       *argv);
+
+CRB_Value crb_native_mem_profile(CRB_Interpreter *interpreter,
+                                 int              argc,
+                                 CRB_Value       *argv);
+
+CRB_Value crb_native_gc_stats(CRB_Interpreter *interpreter,
+                              int              argc,
+                              CRB_Value       *argv);
+
+CRB_Value crb_native_add(CRB_Interpreter *interpreter,
+                         int              argc,
+                         CRB_Value       *argv);
+
+CRB_Value crb_native_size(CRB_Interpreter *interpreter,
+                          int              argc,
+                          CRB_Value       *argv);
+
+CRB_Value crb_native_get(CRB_Interpreter *interpreter,
+                         int              argc,
+                         CRB_Value       *argv);
+
+CRB_Value crb_native_put(CRB_Interpreter *interpreter,
+                         int              argc,
+                         CRB_Value       *argv);
+
+CRB_Value crb_native_remove(CRB_Interpreter *interpreter,
+                            int              argc,
+                            CRB_Value       *argv);
+
+CRB_Value crb_native_keys(CRB_Interpreter *interpreter,
+                          int              argc,
+                          CRB_Value       *argv);
+
+CRB_Value crb_native_fopen(CRB_Interpreter *interpreter,
+                          int              argc,
+                          CRB_Value       *argv);
+
+CRB_Value crb_native_int_array(CRB_Interpreter *interpreter,
+                               int              argc,
+                               CRB_Value       *argv);
+
+CRB_Value crb_native_double_array(CRB_Interpreter *interpreter,
+                                  int              argc,
+                                  CRB_Value       *argv);
+
+CRB_Value crb_native_sum(CRB_Interpreter *interpreter,
+                         int              argc,
+                         CRB_Value       *argv);
+
+CRB_Value crb_native_min(CRB_Interpreter *interpreter,
+                         int              argc,
+                         CRB_Value       *argv);
+
+CRB_Value crb_native_max(CRB_Interpreter *interpreter,
+                         int              argc,
+                         CRB_Value       *argv);
+
+CRB_Value crb_native_dot(CRB_Interpreter *interpreter,
+                         int              argc,
+                         CRB_Value       *argv);
+
+CRB_Value crb_native_scale(CRB_Interpreter *interpreter,
+                           int              argc,
+                           CRB_Value       *argv);
+
+CRB_Value crb_native_fill(CRB_Interpreter *interpreter,
+                          int              argc,
+                          CRB_Value       *argv);
+
 #endif // CROWBAR_H
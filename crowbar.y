@@ -9,6 +9,9 @@ int yylex();  // 消除-std=c99以上的implicit declaration的warning
     char           *identifier;
     ParameterList  *parameter_list;
     ArgumentList   *argument_list;
+    ExpressionList *expression_list;
+    KeyValueList   *key_value_list;
+    FieldInitList  *field_init_list;
     Expression     *expression;
     Statement      *statement;
     StatementList  *statement_list;
@@ -20,7 +23,7 @@ int yylex();  // 消除-std=c99以上的implicit declaration的warning
 %token <expression> DOUBLE_LITERAL
 %token <expression> STRING_LITERAL
 %token <identifier> IDENTIFIER
-%token FUNCTION IF ELSE ELSIF WHILE FOR RETURN_T BREAK CONTINUE NULL_T LP RP LC RC SEMICOLON COMMA ASSIGN LOGICAL_AND LOGICAL_OR EQ NE GT GE LT LE ADD SUB MUL DIV MOD TRUE_T FALSE_T GLOBAL_T INCREMENT DECREMENT DOT LB RB
+%token FUNCTION IF ELSE ELSIF WHILE FOR RETURN_T BREAK CONTINUE NULL_T LP RP LC RC SEMICOLON COMMA COLON ASSIGN LOGICAL_AND LOGICAL_OR EQ NE GT GE LT LE ADD SUB MUL DIV MOD TRUE_T FALSE_T GLOBAL_T INCREMENT DECREMENT DOT LB RB ADD_ASSIGN SUB_ASSIGN MUL_ASSIGN DIV_ASSIGN CONST_T
 
 /* Declare types for for non-terminal symbols */
 %type <parameter_list>
@@ -40,7 +43,14 @@ unary_expression
 primary_expression
 postfix_expression
 array_literal /* 数组初始化表达式 */
+map_literal /* 映射初始化表达式 */
+record_literal /* 记录初始化表达式 */
+%type <expression_list>
 expression_list /* 逗号分割的表达式列表 */
+%type <key_value_list>
+key_value_list /* 逗号分割的键值对列表 */
+%type <field_init_list>
+field_init_list /* 逗号分割的字段初始化列表 */
 %type <statement>
 statement
 global_statement
@@ -66,12 +76,19 @@ translation_unit
     ;
 definition_or_statement
     : function_definition
+    | constant_definition
     | statement
     {
         CRB_Interpreter *interpreter = crb_get_current_interpreter();
         interpreter->statement_list = crb_chain_statement_list(interpreter->statement_list, $1);
     }
     ;
+constant_definition
+    : CONST_T IDENTIFIER ASSIGN expression SEMICOLON
+    {
+        crb_constant_define($2, $4);
+    }
+    ;
 function_definition
     : FUNCTION IDENTIFIER LP parameter_list RP block
     {
@@ -118,6 +135,22 @@ expression
     {
         $$ = crb_create_assign_expression($1, $3);
     }
+    | postfix_expression ADD_ASSIGN expression
+    {
+        $$ = crb_create_compound_assign_expression(ADD_ASSIGN_EXPRESSION, $1, $3);
+    }
+    | postfix_expression SUB_ASSIGN expression
+    {
+        $$ = crb_create_compound_assign_expression(SUB_ASSIGN_EXPRESSION, $1, $3);
+    }
+    | postfix_expression MUL_ASSIGN expression
+    {
+        $$ = crb_create_compound_assign_expression(MUL_ASSIGN_EXPRESSION, $1, $3);
+    }
+    | postfix_expression DIV_ASSIGN expression
+    {
+        $$ = crb_create_compound_assign_expression(DIV_ASSIGN_EXPRESSION, $1, $3);
+    }
     ;
 logical_or_expression
     : logical_and_expression
@@ -200,10 +233,29 @@ unary_expression
 postfix_expression
     : primary_expression
     | postfix_expression LB expression RB
+    {
+        $$ = crb_create_index_expression($1, $3);
+    }
     | postfix_expression DOT IDENTIFIER LP argument_list RP
+    {
+        $$ = crb_create_method_call_expression($1, $3, $5);
+    }
     | postfix_expression DOT IDENTIFIER LP RP
+    {
+        $$ = crb_create_method_call_expression($1, $3, NULL);
+    }
+    | postfix_expression DOT IDENTIFIER
+    {
+        $$ = crb_create_field_expression($1, $3);
+    }
     | postfix_expression INCREMENT
+    {
+        $$ = crb_create_inc_dec_expression(INCREMENT_EXPRESSION, $1);
+    }
     | postfix_expression DECREMENT
+    {
+        $$ = crb_create_inc_dec_expression(DECREMENT_EXPRESSION, $1);
+    }
     ;
 primary_expression
     : IDENTIFIER LP argument_list RP
@@ -238,16 +290,74 @@ primary_expression
         $$ = crb_create_null_expression();
     }
     | array_literal
+    | map_literal
+    | record_literal
     ;
 array_literal
-    : LC expression_list RC { $$ = $2; /* TODO */ }
-    | LC expression_list COMMA RC { $$ = $2; /* TODO */ }
+    : LC expression_list RC
+    {
+        $$ = crb_create_array_expression($2);
+    }
+    | LC expression_list COMMA RC
+    {
+        $$ = crb_create_array_expression($2);
+    }
     ;
 expression_list
     : expression
+    {
+        $$ = crb_create_expression_list($1);
+    }
     | expression_list COMMA expression
+    {
+        $$ = crb_chain_expression_list($1, $3);
+    }
     | { $$ = NULL; }
     ;
+map_literal
+    : LC key_value_list RC
+    {
+        $$ = crb_create_map_expression($2);
+    }
+    | LC key_value_list COMMA RC
+    {
+        $$ = crb_create_map_expression($2);
+    }
+    | LC COLON RC
+    {
+        $$ = crb_create_map_expression(NULL);
+    }
+    ;
+key_value_list
+    : expression COLON expression
+    {
+        $$ = crb_create_key_value_list($1, $3);
+    }
+    | key_value_list COMMA expression COLON expression
+    {
+        $$ = crb_chain_key_value_list($1, $3, $5);
+    }
+    ;
+record_literal
+    : LC field_init_list RC
+    {
+        $$ = crb_create_record_expression($2);
+    }
+    | LC field_init_list COMMA RC
+    {
+        $$ = crb_create_record_expression($2);
+    }
+    ;
+field_init_list
+    : DOT IDENTIFIER ASSIGN expression
+    {
+        $$ = crb_create_field_init_list($2, $4);
+    }
+    | field_init_list COMMA DOT IDENTIFIER ASSIGN expression
+    {
+        $$ = crb_chain_field_init_list($1, $4, $6);
+    }
+    ;
 statement
     : expression SEMICOLON
     {
@@ -0,0 +1,191 @@
+/**
+ * escape.c
+ * 字符串临时值的逃逸分析.
+ *
+ * 字符串连接和比较只读取操作数的内容, 不保留操作数本身, 读取映射元素时的下标也是如此.
+ * 所以作为它们操作数的连接表达式, 结果不会逃逸出所在的表达式,
+ * 可以分配在临时区中, 由语句的表达式求值结束时统一回收.
+ * 赋值, 函数实参, 返回值等位置的结果会被保存下来, 仍然分配在堆上.
+ */
+
+#include "crowbar.h"
+
+static void analyze_statement_list(StatementList *list);
+
+static void analyze_expression(Expression *expr, CRB_Boolean consumed);
+
+// 下标赋值时下标可能成为映射的键, 会被保存下来
+static void
+analyze_left_value(Expression *left)
+{
+    if (left->type == INDEX_EXPRESSION) {
+        analyze_expression(left->u.index_expression.array, CRB_FALSE);
+        analyze_expression(left->u.index_expression.index, CRB_FALSE);
+    }
+    else if (left->type == FIELD_EXPRESSION) {
+        analyze_expression(left->u.field_expression.record, CRB_FALSE);
+    }
+}
+
+/**
+ * consumed: 父结点是否只读取这个表达式的结果
+ */
+static void
+analyze_expression(Expression *expr, CRB_Boolean consumed)
+{
+    if (expr == NULL) {
+        return;
+    }
+
+    switch (expr->type) {
+        case ADD_EXPRESSION:
+            expr->is_temporary = consumed;
+            analyze_expression(expr->u.binary_expression.left, CRB_TRUE);
+            analyze_expression(expr->u.binary_expression.right, CRB_TRUE);
+            break;
+        case EQ_EXPRESSION:
+        case NE_EXPRESSION:
+        case GT_EXPRESSION:
+        case GE_EXPRESSION:
+        case LT_EXPRESSION:
+        case LE_EXPRESSION:
+            analyze_expression(expr->u.binary_expression.left, CRB_TRUE);
+            analyze_expression(expr->u.binary_expression.right, CRB_TRUE);
+            break;
+        case SUB_EXPRESSION:
+        case MUL_EXPRESSION:
+        case DIV_EXPRESSION:
+        case MOD_EXPRESSION:
+        case LOGICAL_AND_EXPRESSION:
+        case LOGICAL_OR_EXPRESSION:
+            analyze_expression(expr->u.binary_expression.left, CRB_FALSE);
+            analyze_expression(expr->u.binary_expression.right, CRB_FALSE);
+            break;
+        case ASSIGN_EXPRESSION:
+            analyze_left_value(expr->u.assign_expression.left);
+            analyze_expression(expr->u.assign_expression.operand, CRB_FALSE);
+            break;
+        case ADD_ASSIGN_EXPRESSION:
+        case SUB_ASSIGN_EXPRESSION:
+        case MUL_ASSIGN_EXPRESSION:
+        case DIV_ASSIGN_EXPRESSION:
+            // 结果写回左值, 右操作数只被读取
+            analyze_left_value(expr->u.assign_expression.left);
+            analyze_expression(expr->u.assign_expression.operand, CRB_TRUE);
+            break;
+        case INCREMENT_EXPRESSION:
+        case DECREMENT_EXPRESSION:
+            analyze_left_value(expr->u.inc_dec);
+            break;
+        case MINUS_EXPRESSION:
+            analyze_expression(expr->u.minus_expression, CRB_FALSE);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            for (ArgumentList *arg = expr->u.function_call_expression.argument;
+                 arg != NULL; arg = arg->next) {
+                analyze_expression(arg->expression, CRB_FALSE);
+            }
+            break;
+        case METHOD_CALL_EXPRESSION:
+            analyze_expression(expr->u.method_call_expression.receiver, CRB_FALSE);
+            for (ArgumentList *arg = expr->u.method_call_expression.argument;
+                 arg != NULL; arg = arg->next) {
+                analyze_expression(arg->expression, CRB_FALSE);
+            }
+            break;
+        case ARRAY_EXPRESSION:
+            // 元素保存在数组中
+            for (ExpressionList *pos = expr->u.array_literal; pos != NULL; pos = pos->next) {
+                analyze_expression(pos->expression, CRB_FALSE);
+            }
+            break;
+        case INDEX_EXPRESSION:
+            // 读取元素时下标只用来查找
+            analyze_expression(expr->u.index_expression.array, CRB_FALSE);
+            analyze_expression(expr->u.index_expression.index, CRB_TRUE);
+            break;
+        case RECORD_EXPRESSION:
+            for (FieldInitList *pos = expr->u.record_literal.field; pos != NULL; pos = pos->next) {
+                analyze_expression(pos->value, CRB_FALSE);
+            }
+            break;
+        case FIELD_EXPRESSION:
+            analyze_expression(expr->u.field_expression.record, CRB_FALSE);
+            break;
+        case MAP_EXPRESSION:
+            for (KeyValueList *pos = expr->u.map_literal; pos != NULL; pos = pos->next) {
+                analyze_expression(pos->key, CRB_FALSE);
+                analyze_expression(pos->value, CRB_FALSE);
+            }
+            break;
+        case INLINE_CALL_EXPRESSION:
+            // 实参和局部变量的值保存在槽位中, 函数体的结果作为返回值
+            for (ArgumentList *arg = expr->u.inline_call_expression.argument;
+                 arg != NULL; arg = arg->next) {
+                analyze_expression(arg->expression, CRB_FALSE);
+            }
+            for (InlineAssignList *pos = expr->u.inline_call_expression.assign;
+                 pos != NULL; pos = pos->next) {
+                analyze_expression(pos->value, CRB_FALSE);
+            }
+            analyze_expression(expr->u.inline_call_expression.result, CRB_FALSE);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+analyze_statement(Statement *statement)
+{
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            analyze_expression(statement->u.expression_s, CRB_FALSE);
+            break;
+        case IF_STATEMENT:
+            analyze_expression(statement->u.if_s.condition, CRB_FALSE);
+            analyze_statement_list(statement->u.if_s.then_block->statement_list);
+            for (Elsif *pos = statement->u.if_s.elsif_list; pos != NULL; pos = pos->next) {
+                analyze_expression(pos->condition, CRB_FALSE);
+                analyze_statement_list(pos->block->statement_list);
+            }
+            if (statement->u.if_s.else_block != NULL) {
+                analyze_statement_list(statement->u.if_s.else_block->statement_list);
+            }
+            break;
+        case WHILE_STATEMENT:
+            analyze_expression(statement->u.while_s.condition, CRB_FALSE);
+            analyze_statement_list(statement->u.while_s.block->statement_list);
+            break;
+        case FOR_STATEMENT:
+            analyze_expression(statement->u.for_s.init, CRB_FALSE);
+            analyze_expression(statement->u.for_s.condition, CRB_FALSE);
+            analyze_expression(statement->u.for_s.post, CRB_FALSE);
+            analyze_statement_list(statement->u.for_s.block->statement_list);
+            break;
+        case RETURN_STATEMENT:
+            analyze_expression(statement->u.return_s.return_value, CRB_FALSE);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+analyze_statement_list(StatementList *list)
+{
+    for (StatementList *pos = list; pos != NULL; pos = pos->next) {
+        analyze_statement(pos->statement);
+    }
+}
+
+void
+crb_analyze_escape(CRB_Interpreter *interpreter)
+{
+    analyze_statement_list(interpreter->statement_list);
+    for (FunctionDefinition *func = interpreter->function_list; func != NULL; func = func->next) {
+        if (func->type == CROWBAR_FUNCTION_DEFINITION) {
+            analyze_statement_list(func->u.crowbar_f.block->statement_list);
+        }
+    }
+}
@@ -1,6 +1,7 @@
 #include "crowbar.h"
 #include "DBG.h"
 #include "CRB_dev.h"
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>  // fmod
 
@@ -32,7 +33,7 @@ static CRB_Value eval_string_expression(char *string_value)
 {
     CRB_Value v = {
         .type = CRB_STRING_VALUE,
-        .u.string_value = crb_literal_to_crb_string(string_value),
+        .u.string_value = crb_auto_intern_string(crb_literal_to_crb_string(string_value)),
     };
     return v;
 }
@@ -46,20 +47,6 @@ static CRB_Value eval_boolean_expression(CRB_Boolean boolean_value)
     return v;
 }
 
-void refer_if_string(CRB_Value *value)
-{
-    if (value->type == CRB_STRING_VALUE) {
-        crb_refer_string(value->u.string_value);
-    }
-}
-
-void release_if_string(CRB_Value *value)
-{
-    if (value->type == CRB_STRING_VALUE) {
-        crb_release_string(value->u.string_value);
-    }
-}
-
 static Variable *search_local_variable_from_env(LocalEnvironment *env,
                                                 const char       *name)
 {
@@ -108,39 +95,320 @@ void crb_add_local_variable(LocalEnvironment *env, const char *identifier, CRB_V
     env->variable = new_var;
 }
 
+static CRB_Value *lookup_identifier_value(CRB_Interpreter  *interpreter,
+                                          LocalEnvironment *env,
+                                          Expression       *expr)
+{
+    Variable *variable = search_local_variable_from_env(env, expr->u.identifier) ?:
+                         search_global_variable_from_env(interpreter, env, expr->u.identifier);
+    if (variable == NULL) {
+        DBG_panic("%s undefined!", expr->u.identifier);
+        exit(1);
+    }
+    return &variable->value;
+}
+
 static CRB_Value eval_identifier_expression(CRB_Interpreter  *interpreter,
                                             LocalEnvironment *env,
                                             Expression       *expr)
 {
-    CRB_Value value;
-    Variable *variable = search_local_variable_from_env(env, expr->u.identifier);
-    if (variable != NULL) {
-        value = variable->value;
+    CRB_Value value = *lookup_identifier_value(interpreter, env, expr);
+    crb_refer_value(&value);
+    return value;
+}
+
+/**
+ * 借用求值: 标识符和槽位直接返回变量中的值, 不增加引用计数, *owned 置为 CRB_FALSE;
+ * 其余表达式正常求值, *owned 置为 CRB_TRUE.
+ * 借用的值只在变量不被修改期间有效, 所以调用者要保证在用完之前
+ * 不再对有副作用的表达式求值, 并且只在 *owned 时释放.
+ */
+static CRB_Value eval_expression_borrowed(CRB_Interpreter  *interpreter,
+                                          LocalEnvironment *env,
+                                          Expression       *expr,
+                                          CRB_Boolean      *owned)
+{
+    if (expr->type == IDENTIFIER_EXPRESSION) {
+        *owned = CRB_FALSE;
+        return *lookup_identifier_value(interpreter, env, expr);
+    }
+    if (expr->type == SLOT_EXPRESSION) {
+        *owned = CRB_FALSE;
+        return interpreter->inline_frame[expr->u.slot];
+    }
+    *owned = CRB_TRUE;
+    return eval_expression(interpreter, env, expr);
+}
+
+/**
+ * 数组下标必须是 int
+ */
+static int element_index(CRB_Value  *index,
+                         Expression *expr)
+{
+    if (index->type != CRB_INT_VALUE) {
+        crb_runtime_error(expr->line_number, "array index is not an int");
+    }
+    return index->u.int_value;
+}
+
+/**
+ * 取得 array[index] 所在的地址, 操作数类型不对或者越界时报告运行时错误
+ */
+static CRB_Value *lookup_element(CRB_Value  *array,
+                                 CRB_Value  *index,
+                                 Expression *expr)
+{
+    return crb_array_element(array->u.array_value, element_index(index, expr));
+}
+
+/**
+ * container[index], 容器是数组, 数值数组或映射, 映射中不存在的键得到 null
+ */
+static CRB_Value eval_index_expression(CRB_Interpreter  *interpreter,
+                                       LocalEnvironment *env,
+                                       Expression       *expr)
+{
+    Expression *index = expr->u.index_expression.index;
+    CRB_Value container;
+    CRB_Boolean container_owned = CRB_TRUE;
+    CRB_Boolean index_owned;
+
+    // 与二元表达式相同: 下标没有副作用时容器可以借用, 下标之后不再求值, 总是可以借用
+    if (index->has_side_effect) {
+        container = eval_expression(interpreter, env, expr->u.index_expression.array);
     }
     else {
-        variable = search_global_variable_from_env(interpreter, env, expr->u.identifier);
-        if (variable != NULL) {
-            value = variable->value;
+        container = eval_expression_borrowed(interpreter, env, expr->u.index_expression.array, &container_owned);
+    }
+    int root_top = crb_gc_push_root(interpreter, &container);
+    CRB_Value index_val = eval_expression_borrowed(interpreter, env, index, &index_owned);
+    crb_gc_pop_root(interpreter, root_top);
+
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+    if (container.type == CRB_ARRAY_VALUE) {
+        value = *lookup_element(&container, &index_val, expr);
+    }
+    else if (container.type == CRB_MAP_VALUE) {
+        CRB_Value *found = crb_map_get(container.u.map_value, &index_val);
+        if (found != NULL) {
+            value = *found;
         }
-        else {
-            DBG_panic("%s undefined!", expr->u.identifier);
+    }
+    else if (container.type == CRB_TYPED_ARRAY_VALUE) {
+        value = crb_typed_array_get(container.u.typed_array_value, element_index(&index_val, expr));
+    }
+    else {
+        crb_runtime_error(expr->line_number, "index operand is not an array or a map");
+    }
+
+    crb_refer_value(&value);
+    if (index_owned) {
+        crb_release_value(&index_val);
+    }
+    if (container_owned) {
+        crb_release_value(&container);
+    }
+    return value;
+}
+
+/**
+ * 数组字面量, 元素依次求值后直接放进数组
+ */
+static CRB_Value eval_array_expression(CRB_Interpreter  *interpreter,
+                                       LocalEnvironment *env,
+                                       Expression       *expr)
+{
+    int size = 0;
+    for (ExpressionList *pos = expr->u.array_literal; pos != NULL; pos = pos->next) {
+        size++;
+    }
+
+    CRB_Value value = {
+        .type = CRB_ARRAY_VALUE,
+        .u.array_value = crb_create_array(interpreter, size),
+    };
+    // 元素中的函数调用会经过安全点
+    int root_top = crb_gc_push_root(interpreter, &value);
+    int i = 0;
+    for (ExpressionList *pos = expr->u.array_literal; pos != NULL; pos = pos->next) {
+        value.u.array_value->element[i] = eval_expression(interpreter, env, pos->expression);
+        crb_gc_write_barrier(interpreter, &value.u.array_value->element[i++]);
+    }
+    crb_gc_pop_root(interpreter, root_top);
+
+    return value;
+}
+
+/**
+ * container[index] = operand, 依次对容器, 下标, 右值求值.
+ * 映射中不存在的键会被加入
+ */
+static CRB_Value eval_assign_element(CRB_Interpreter  *interpreter,
+                                     LocalEnvironment *env,
+                                     Expression       *left,
+                                     Expression       *operand)
+{
+    CRB_Value container = eval_expression(interpreter, env, left->u.index_expression.array);
+    int root_top = crb_gc_push_root(interpreter, &container);
+    CRB_Value index_val = eval_expression(interpreter, env, left->u.index_expression.index);
+    crb_gc_push_root(interpreter, &index_val);
+    CRB_Value value = eval_expression(interpreter, env, operand);
+    crb_gc_pop_root(interpreter, root_top);
+
+    if (container.type == CRB_ARRAY_VALUE) {
+        CRB_Value *dest = lookup_element(&container, &index_val, left);
+        crb_release_value(dest);
+        *dest = value;
+        crb_refer_value(&value);
+        crb_gc_write_barrier(interpreter, &value);
+    }
+    else if (container.type == CRB_MAP_VALUE) {
+        crb_map_put(interpreter, container.u.map_value, &index_val, &value);
+    }
+    else if (container.type == CRB_TYPED_ARRAY_VALUE) {
+        crb_typed_array_set(container.u.typed_array_value, element_index(&index_val, left), &value);
+    }
+    else {
+        crb_runtime_error(left->line_number, "index operand is not an array or a map");
+    }
+
+    crb_release_value(&index_val);
+    crb_release_value(&container);
+    return value;
+}
+
+/**
+ * 映射字面量, 后出现的重复键覆盖先出现的
+ */
+static CRB_Value eval_map_expression(CRB_Interpreter  *interpreter,
+                                     LocalEnvironment *env,
+                                     Expression       *expr)
+{
+    CRB_Value value = {
+        .type = CRB_MAP_VALUE,
+        .u.map_value = crb_create_map(interpreter),
+    };
+    int root_top = crb_gc_push_root(interpreter, &value);
+    for (KeyValueList *pos = expr->u.map_literal; pos != NULL; pos = pos->next) {
+        CRB_Value key = eval_expression(interpreter, env, pos->key);
+        int key_top = crb_gc_push_root(interpreter, &key);
+        CRB_Value element = eval_expression(interpreter, env, pos->value);
+        crb_gc_pop_root(interpreter, key_top);
+
+        crb_map_put(interpreter, value.u.map_value, &key, &element);
+        crb_release_value(&key);
+        crb_release_value(&element);
+    }
+    crb_gc_pop_root(interpreter, root_top);
+
+    return value;
+}
+
+/**
+ * 记录字面量, 字段依次求值后按形状中的顺序放进记录
+ */
+static CRB_Value eval_record_expression(CRB_Interpreter  *interpreter,
+                                        LocalEnvironment *env,
+                                        Expression       *expr)
+{
+    CRB_Value value = {
+        .type = CRB_RECORD_VALUE,
+        .u.record_value = crb_create_record(interpreter, expr->u.record_literal.shape),
+    };
+    // 字段中的函数调用会经过安全点
+    int root_top = crb_gc_push_root(interpreter, &value);
+    int i = 0;
+    for (FieldInitList *pos = expr->u.record_literal.field; pos != NULL; pos = pos->next) {
+        value.u.record_value->field[i] = eval_expression(interpreter, env, pos->value);
+        crb_gc_write_barrier(interpreter, &value.u.record_value->field[i++]);
+    }
+    crb_gc_pop_root(interpreter, root_top);
+
+    return value;
+}
+
+/**
+ * 取得 record.name 所在的地址. 形状与访问点缓存的形状相同时直接使用缓存的下标,
+ * 否则在形状中查找字段并更新缓存
+ */
+static CRB_Value *lookup_field(CRB_Value  *record,
+                               Expression *expr)
+{
+    FieldExpression *field = &expr->u.field_expression;
+
+    if (record->type != CRB_RECORD_VALUE) {
+        crb_runtime_error(expr->line_number, "field %s accessed on a non-record value", field->name);
+    }
+    RecordShape *shape = record->u.record_value->shape;
+    if (shape != field->cached_shape) {
+        int index = crb_shape_field_index(shape, field->name);
+        if (index < 0) {
+            crb_runtime_error(expr->line_number, "record has no field %s", field->name);
         }
+        field->cached_shape = shape;
+        field->cached_index = index;
     }
-    refer_if_string(&value);
+    return &record->u.record_value->field[field->cached_index];
+}
+
+static CRB_Value eval_field_expression(CRB_Interpreter  *interpreter,
+                                       LocalEnvironment *env,
+                                       Expression       *expr)
+{
+    CRB_Boolean owned;
+    CRB_Value record = eval_expression_borrowed(interpreter, env, expr->u.field_expression.record, &owned);
+
+    CRB_Value value = *lookup_field(&record, expr);
+    crb_refer_value(&value);
+    if (owned) {
+        crb_release_value(&record);
+    }
+    return value;
+}
+
+/**
+ * record.name = operand, 先对记录求值, 再对右值求值
+ */
+static CRB_Value eval_assign_field(CRB_Interpreter  *interpreter,
+                                   LocalEnvironment *env,
+                                   Expression       *left,
+                                   Expression       *operand)
+{
+    CRB_Value record = eval_expression(interpreter, env, left->u.field_expression.record);
+    int root_top = crb_gc_push_root(interpreter, &record);
+    CRB_Value value = eval_expression(interpreter, env, operand);
+    crb_gc_pop_root(interpreter, root_top);
+
+    CRB_Value *dest = lookup_field(&record, left);
+    crb_release_value(dest);
+    *dest = value;
+    crb_refer_value(&value);
+    crb_gc_write_barrier(interpreter, &value);
+
+    crb_release_value(&record);
     return value;
 }
 
 static CRB_Value eval_assign_expression(CRB_Interpreter  *interpreter,
                                         LocalEnvironment *env,
-                                        const char       *identifier,
+                                        Expression       *left_value,
                                         Expression       *expr)
 {
+    if (left_value->type == INDEX_EXPRESSION) {
+        return eval_assign_element(interpreter, env, left_value, expr);
+    }
+    if (left_value->type == FIELD_EXPRESSION) {
+        return eval_assign_field(interpreter, env, left_value, expr);
+    }
+
+    const char *identifier = left_value->u.identifier;
     CRB_Value value = eval_expression(interpreter, env, expr);
     // 使用 Elvis 操作符 ?: 简化回滚写法
     Variable *left = search_local_variable_from_env(env, identifier) ?:
                      search_global_variable_from_env(interpreter, env, identifier);
     if (left != NULL) {
-        release_if_string(&left->value);
+        crb_release_value(&left->value);
         left->value = value;
     }
     else {
@@ -151,7 +419,7 @@ static CRB_Value eval_assign_expression(CRB_Interpreter  *interpreter,
             crb_add_local_variable(env, identifier, &value);
         }
     }
-    refer_if_string(&value);
+    crb_refer_value(&value);
     return value;
 }
 
@@ -307,34 +575,48 @@ eval_binary_boolean(ExpressionType type, CRB_Boolean left, CRB_Boolean right, CR
 }
 
 /**
- * 链接两个字符串，并自动扩容
+ * 链接字符串与 right 开始的 right_len 个字符. 不改变操作数的引用计数.
+ * is_temporary 时结果分配在临时区中, 它不会逃逸出当前语句, 也不参与驻留
  */
 CRB_String *
-chain_string(CRB_String *left, CRB_String *right)
+chain_string(CRB_Interpreter *interpreter,
+             CRB_String      *left,
+             const char      *right,
+             size_t           right_len,
+             CRB_Boolean      is_temporary)
 {
-    size_t left_len = strlen(left->string);
-    size_t right_len = strlen(right->string);
+    size_t left_len = left->length;
 
-    size_t len = left_len + right_len;
-    char *str = MEM_malloc(len + 1);
-    strcpy(str, left->string);
-    strcpy(str + left_len, right->string);
-    CRB_String *ret = crb_create_crb_string(str);
-    crb_release_string(left);
-    crb_release_string(right);
+    CRB_String *ret = is_temporary ?
+                      crb_alloc_scratch_string(interpreter, left_len + right_len) :
+                      crb_alloc_crb_string(left_len + right_len);
+    memcpy(ret->string, left->string, left_len);
+    memcpy(ret->string + left_len, right, right_len);
+    ret->string[left_len + right_len] = '\0';
 
-    return ret;
+    return is_temporary ? ret : crb_auto_intern_string(ret);
 }
 
 /**
- * 根据表达式类型比较字符串并减少临时变量的引用计数
+ * 根据表达式类型比较字符串
  */
 static CRB_Boolean
 eval_compare_string(ExpressionType  type,
                     CRB_Value      *left,
                     CRB_Value      *right)
 {
-    int cmp = strcmp(left->u.string_value->string, right->u.string_value->string);
+    CRB_String *left_str = left->u.string_value;
+    CRB_String *right_str = right->u.string_value;
+    int cmp;
+
+    // 两边都已驻留时, 内容相等当且仅当指针相等
+    if (left_str->is_interned && right_str->is_interned
+            && (type == EQ_EXPRESSION || type == NE_EXPRESSION)) {
+        cmp = (left_str == right_str) ? 0 : 1;
+    }
+    else {
+        cmp = crb_compare_string(left_str, right_str);
+    }
 
     CRB_Boolean result = CRB_FALSE;
     switch (type) {
@@ -360,89 +642,150 @@ eval_compare_string(ExpressionType  type,
             DBG_panic("Unexpected type");
     }
 
-    crb_release_string(left->u.string_value);
-    crb_release_string(right->u.string_value);
-
     return result;
 }
 
 /**
- * 计算二元表达式
+ * 字符串连接的右操作数转为字符序列, 长度存入 *len.
+ * 数值直接格式化到 buf 中, 容器转换成新的字符串存入 *temp, 由调用者在用完后释放
+ */
+static const char *
+concat_operand_chars(CRB_Value   *value,
+                     char        *buf,
+                     size_t       buf_size,
+                     int         *len,
+                     CRB_String **temp)
+{
+    const char *chars = buf;
+
+    *temp = NULL;
+    if (value->type == CRB_INT_VALUE) {
+        *len = snprintf(buf, buf_size, "%d", value->u.int_value);
+    }
+    else if (value->type == CRB_DOUBLE_VALUE) {
+        *len = snprintf(buf, buf_size, "%f", value->u.double_value);
+    }
+    else if (value->type == CRB_BOOLEAN_VALUE) {
+        chars = (value->u.boolean_value == CRB_TRUE) ? "true" : "false";
+        *len = strlen(chars);
+    }
+    else if (value->type == CRB_STRING_VALUE) {
+        chars = value->u.string_value->string;
+        *len = value->u.string_value->length;
+    }
+    else if (value->type == CRB_NATIVE_POINTER_VALUE) {
+        *len = snprintf(buf, buf_size, "(%s:%p)", value->u.native_pointer.info->name,
+                        value->u.native_pointer.pointer);
+    }
+    else if (value->type == CRB_NULL_VALUE) {
+        chars = "null";
+        *len = strlen(chars);
+    }
+    else if (value->type == CRB_ARRAY_VALUE || value->type == CRB_MAP_VALUE
+             || value->type == CRB_TYPED_ARRAY_VALUE || value->type == CRB_RECORD_VALUE) {
+        *temp = crb_container_to_string(value);
+        chars = (*temp)->string;
+        *len = (*temp)->length;
+    }
+    else {
+        DBG_panic("bad right operand type %d", value->type);
+        chars = "";
+        *len = 0;
+    }
+    return chars;
+}
+
+/**
+ * 对两个已经求值的操作数做二元运算, 不改变操作数的引用计数
  */
 static CRB_Value
-crb_eval_binary_expression(CRB_Interpreter  *interpreter,
-                           LocalEnvironment *env,
-                           ExpressionType    type,
-                           Expression       *left,
-                           Expression       *right)
+eval_binary_values(CRB_Interpreter *interpreter,
+                   ExpressionType   type,
+                   CRB_Value       *left_val,
+                   CRB_Value       *right_val,
+                   CRB_Boolean      is_temporary)
 {
-    CRB_Value left_val;
-    CRB_Value right_val;
     CRB_Value result = {};
 
-    left_val = eval_expression(interpreter, env, left);
-    right_val = eval_expression(interpreter, env, right);
-
     /**
      * 根据不同的类型使用不同的函数
      */
-    if (left_val.type == CRB_INT_VALUE && right_val.type == CRB_INT_VALUE) {
-        eval_binary_int(type, left_val.u.int_value, right_val.u.int_value, &result);
+    if (left_val->type == CRB_INT_VALUE && right_val->type == CRB_INT_VALUE) {
+        eval_binary_int(type, left_val->u.int_value, right_val->u.int_value, &result);
     }
-    else if (left_val.type == CRB_DOUBLE_VALUE && right_val.type == CRB_DOUBLE_VALUE) {
-        eval_binary_double(type, left_val.u.double_value, right_val.u.double_value, &result);
+    else if (left_val->type == CRB_DOUBLE_VALUE && right_val->type == CRB_DOUBLE_VALUE) {
+        eval_binary_double(type, left_val->u.double_value, right_val->u.double_value, &result);
     }
-    else if (left_val.type == CRB_INT_VALUE && right_val.type == CRB_DOUBLE_VALUE) {
-        left_val.u.double_value = left_val.u.int_value;
-        eval_binary_double(type, left_val.u.double_value, right_val.u.double_value, &result);
+    else if (left_val->type == CRB_INT_VALUE && right_val->type == CRB_DOUBLE_VALUE) {
+        eval_binary_double(type, left_val->u.int_value, right_val->u.double_value, &result);
     }
-    else if (left_val.type == CRB_DOUBLE_VALUE && right_val.type == CRB_INT_VALUE) {
-        right_val.u.double_value = right_val.u.int_value;
-        eval_binary_double(type, left_val.u.double_value, right_val.u.double_value, &result);
+    else if (left_val->type == CRB_DOUBLE_VALUE && right_val->type == CRB_INT_VALUE) {
+        eval_binary_double(type, left_val->u.double_value, right_val->u.int_value, &result);
     }
-    else if (left_val.type == CRB_BOOLEAN_VALUE && right_val.type == CRB_BOOLEAN_VALUE) {
-        eval_binary_boolean(type, left_val.u.boolean_value, right_val.u.boolean_value, &result);
+    else if (left_val->type == CRB_BOOLEAN_VALUE && right_val->type == CRB_BOOLEAN_VALUE) {
+        eval_binary_boolean(type, left_val->u.boolean_value, right_val->u.boolean_value, &result);
     }
-    else if (left_val.type == CRB_STRING_VALUE && type == ADD_EXPRESSION) {
+    else if (left_val->type == CRB_STRING_VALUE && type == ADD_EXPRESSION) {
+        // 右操作数直接格式化到栈上的缓冲区, 不需要构造临时字符串
         char buf[LINE_BUF_SIZE];
+        int right_len;
         CRB_String *right_str;
-
-        if (right_val.type == CRB_INT_VALUE) {
-            sprintf(buf, "%d", right_val.u.int_value);
-            right_str = crb_create_crb_string(MEM_strdup(buf));
-        }
-        else if (right_val.type == CRB_DOUBLE_VALUE) {
-            sprintf(buf, "%f", right_val.u.double_value);
-            right_str = crb_create_crb_string(MEM_strdup(buf));
-        }
-        else if (right_val.type == CRB_BOOLEAN_VALUE) {
-            right_str = crb_create_crb_string(MEM_strdup(right_val.u.boolean_value == CRB_TRUE ? "true" : "false"));
-        }
-        else if (right_val.type == CRB_STRING_VALUE) {
-            right_str = right_val.u.string_value;
-        }
-        else if (right_val.type == CRB_NATIVE_POINTER_VALUE) {
-            sprintf(buf, "(%s:%p)", right_val.u.native_pointer.info->name,
-                    right_val.u.native_pointer.pointer);
-            right_str = crb_create_crb_string(MEM_strdup(buf));
-        }
-        else if (right_val.type == CRB_NULL_VALUE) {
-            right_str = crb_create_crb_string(MEM_strdup("null"));
-        }
-        else {
-            right_str = NULL;
-        }
+        const char *right_chars = concat_operand_chars(right_val, buf, sizeof(buf), &right_len, &right_str);
 
         result.type = CRB_STRING_VALUE;
-        result.u.string_value = chain_string(left_val.u.string_value, right_str);
+        result.u.string_value = chain_string(interpreter, left_val->u.string_value,
+                                             right_chars, right_len, is_temporary);
+        if (right_str != NULL) {
+            crb_release_string(right_str);
+        }
     }
-    else if (left_val.type == CRB_STRING_VALUE && right_val.type == CRB_STRING_VALUE && is_compare_operator(type)) {
+    else if (left_val->type == CRB_STRING_VALUE && right_val->type == CRB_STRING_VALUE && is_compare_operator(type)) {
         result.type = CRB_BOOLEAN_VALUE;
-        result.u.boolean_value = eval_compare_string(type, &left_val, &right_val);
+        result.u.boolean_value = eval_compare_string(type, left_val, right_val);
     }
-    else if ((left_val.type == CRB_NULL_VALUE || right_val.type == CRB_NULL_VALUE) && is_compare_operator(type)) {
+    else if ((left_val->type == CRB_NULL_VALUE || right_val->type == CRB_NULL_VALUE) && is_compare_operator(type)) {
         result.type = CRB_BOOLEAN_VALUE;
-        result.u.boolean_value = eval_binary_null(type, &left_val, &right_val);
+        result.u.boolean_value = eval_binary_null(type, left_val, right_val);
+    }
+
+    return result;
+}
+
+/**
+ * 计算二元表达式
+ */
+static CRB_Value
+crb_eval_binary_expression(CRB_Interpreter  *interpreter,
+                           LocalEnvironment *env,
+                           ExpressionType    type,
+                           Expression       *left,
+                           Expression       *right,
+                           CRB_Boolean       is_temporary)
+{
+    CRB_Value left_val;
+    CRB_Value right_val;
+    CRB_Boolean left_owned = CRB_TRUE;
+    CRB_Boolean right_owned;
+
+    // 右操作数没有副作用时左操作数可以借用, 右操作数之后不再求值, 总是可以借用
+    if (right->has_side_effect) {
+        left_val = eval_expression(interpreter, env, left);
+    }
+    else {
+        left_val = eval_expression_borrowed(interpreter, env, left, &left_owned);
+    }
+    // 右操作数中的函数调用会经过安全点, 左操作数需要作为根
+    int root_top = crb_gc_push_root(interpreter, &left_val);
+    right_val = eval_expression_borrowed(interpreter, env, right, &right_owned);
+    crb_gc_pop_root(interpreter, root_top);
+
+    CRB_Value result = eval_binary_values(interpreter, type, &left_val, &right_val, is_temporary);
+
+    if (left_owned) {
+        crb_release_value(&left_val);
+    }
+    if (right_owned) {
+        crb_release_value(&right_val);
     }
     return result;
 }
@@ -466,9 +809,154 @@ eval_binary_null(ExpressionType type,
         DBG_panic("Unexpected type");
     }
 
-    release_if_string(left);
-    release_if_string(right);
+    return result;
+}
+
+/**
+ * 复合赋值和 ++/-- 对应的二元运算
+ */
+static ExpressionType
+update_operator(ExpressionType type)
+{
+    switch (type) {
+        case ADD_ASSIGN_EXPRESSION:
+        case INCREMENT_EXPRESSION:
+            return ADD_EXPRESSION;
+        case SUB_ASSIGN_EXPRESSION:
+        case DECREMENT_EXPRESSION:
+            return SUB_EXPRESSION;
+        case MUL_ASSIGN_EXPRESSION:
+            return MUL_EXPRESSION;
+        case DIV_ASSIGN_EXPRESSION:
+            return DIV_EXPRESSION;
+        default:
+            DBG_panic("bad update operator %d", type);
+            return ADD_EXPRESSION;
+    }
+}
+
+/**
+ * 把 *dest op operand 的结果写回 *dest, 返回表达式的值 (不带引用).
+ * int 运算直接修改, 字符串连接在可能时原地追加, 其余情况与二元表达式相同.
+ * ++/-- 要求操作数是数值, 返回修改前的值
+ */
+static CRB_Value
+update_value(CRB_Interpreter *interpreter,
+             Expression      *expr,
+             CRB_Value       *dest,
+             CRB_Value       *operand)
+{
+    ExpressionType operator = update_operator(expr->type);
+    CRB_Boolean is_inc_dec = (expr->type == INCREMENT_EXPRESSION || expr->type == DECREMENT_EXPRESSION);
+
+    if (is_inc_dec && dest->type != CRB_INT_VALUE && dest->type != CRB_DOUBLE_VALUE) {
+        crb_runtime_error(expr->line_number, "operand of %s is not a number",
+                          (expr->type == INCREMENT_EXPRESSION) ? "++" : "--");
+    }
+    CRB_Value old_value = *dest;
+
+    if (dest->type == CRB_INT_VALUE && operand->type == CRB_INT_VALUE) {
+        eval_binary_int(operator, dest->u.int_value, operand->u.int_value, dest);
+    }
+    else if (dest->type == CRB_STRING_VALUE && operator == ADD_EXPRESSION) {
+        char buf[LINE_BUF_SIZE];
+        int len;
+        CRB_String *temp;
+        const char *chars = concat_operand_chars(operand, buf, sizeof(buf), &len, &temp);
+
+        if (!crb_append_string_in_place(dest->u.string_value, chars, len)) {
+            CRB_String *result = chain_string(interpreter, dest->u.string_value, chars, len, CRB_FALSE);
+            crb_release_string(dest->u.string_value);
+            dest->u.string_value = result;
+        }
+        if (temp != NULL) {
+            crb_release_string(temp);
+        }
+    }
+    else {
+        CRB_Value result = eval_binary_values(interpreter, operator, dest, operand, CRB_FALSE);
+        crb_release_value(dest);
+        *dest = result;
+    }
+    // dest 可能是容器的元素
+    crb_gc_write_barrier(interpreter, dest);
+
+    return is_inc_dec ? old_value : *dest;
+}
+
+/**
+ * left op= operand, left++, left--.
+ * 左值只解析一次: 变量只查找一次, 下标表达式的容器和下标, 字段访问的记录都只求值一次
+ */
+static CRB_Value
+eval_update_expression(CRB_Interpreter  *interpreter,
+                       LocalEnvironment *env,
+                       Expression       *expr)
+{
+    CRB_Boolean is_inc_dec = (expr->type == INCREMENT_EXPRESSION || expr->type == DECREMENT_EXPRESSION);
+    Expression *left = is_inc_dec ? expr->u.inc_dec : expr->u.assign_expression.left;
+    // ++ 和 -- 相当于 += 1 和 -= 1
+    CRB_Value operand = { .type = CRB_INT_VALUE, .u.int_value = 1 };
+    CRB_Value result;
+
+    if (left->type == IDENTIFIER_EXPRESSION) {
+        if (!is_inc_dec) {
+            operand = eval_expression(interpreter, env, expr->u.assign_expression.operand);
+        }
+        result = update_value(interpreter, expr, lookup_identifier_value(interpreter, env, left), &operand);
+        crb_refer_value(&result);
+        crb_release_value(&operand);
+        return result;
+    }
+
+    if (left->type == FIELD_EXPRESSION) {
+        CRB_Value record = eval_expression(interpreter, env, left->u.field_expression.record);
+        int root_top = crb_gc_push_root(interpreter, &record);
+        if (!is_inc_dec) {
+            operand = eval_expression(interpreter, env, expr->u.assign_expression.operand);
+        }
+        crb_gc_pop_root(interpreter, root_top);
+
+        result = update_value(interpreter, expr, lookup_field(&record, left), &operand);
+        crb_refer_value(&result);
+        crb_release_value(&operand);
+        crb_release_value(&record);
+        return result;
+    }
+
+    CRB_Value container = eval_expression(interpreter, env, left->u.index_expression.array);
+    int root_top = crb_gc_push_root(interpreter, &container);
+    CRB_Value index_val = eval_expression(interpreter, env, left->u.index_expression.index);
+    crb_gc_push_root(interpreter, &index_val);
+    if (!is_inc_dec) {
+        operand = eval_expression(interpreter, env, expr->u.assign_expression.operand);
+    }
+    crb_gc_pop_root(interpreter, root_top);
+
+    if (container.type == CRB_ARRAY_VALUE) {
+        result = update_value(interpreter, expr, lookup_element(&container, &index_val, left), &operand);
+    }
+    else if (container.type == CRB_MAP_VALUE) {
+        CRB_Value *dest = crb_map_get(container.u.map_value, &index_val);
+        if (dest == NULL) {
+            crb_runtime_error(left->line_number, "map key not found");
+        }
+        result = update_value(interpreter, expr, dest, &operand);
+    }
+    else if (container.type == CRB_TYPED_ARRAY_VALUE) {
+        int index = element_index(&index_val, left);
+        CRB_Value element = crb_typed_array_get(container.u.typed_array_value, index);
+        result = update_value(interpreter, expr, &element, &operand);
+        crb_typed_array_set(container.u.typed_array_value, index, &element);
+    }
+    else {
+        crb_runtime_error(left->line_number, "index operand is not an array or a map");
+    }
 
+    crb_refer_value(&result);
+    crb_release_value(&operand);
+    crb_release_value(&index_val);
+    crb_release_value(&container);
     return result;
 }
 
@@ -542,22 +1030,25 @@ alloc_local_environment()
     LocalEnvironment *ret = MEM_malloc(sizeof(LocalEnvironment));
     ret->variable = NULL;
     ret->global_variable = NULL;
+    ret->caller = NULL;
     return ret;
 }
 
 /**
  * 释放临时运行环境，释放的对象有：
- * 局部变量的定义，字符串的引用计数，全局变量的引用
+ * 局部变量的定义，字符串的引用计数，环境本身.
+ * 全局变量的引用由调用者回退运行时存储器时回收.
  */
 static void
 dispose_local_environment(LocalEnvironment *env)
 {
     while (env->variable != NULL) {
         Variable *temp = env->variable;
-        release_if_string(&temp->value);
+        crb_release_value(&temp->value);
         env->variable = temp->next;
         MEM_free(temp);
     }
+    MEM_free(env);
 }
 
 /**
@@ -569,6 +1060,8 @@ static CRB_Value call_crowbar_function(CRB_Interpreter    *interpreter,
                                        FunctionDefinition *func)
 {
     LocalEnvironment *local_env = alloc_local_environment();
+    // 先登记运行环境, 已求值的实参在求值后面的实参时也是根
+    crb_gc_push_environment(interpreter, local_env);
     ArgumentList *arg;
     ParameterList *param;
     for (arg = expr->u.function_call_expression.argument, param = func->u.crowbar_f.parameter;
@@ -581,6 +1074,12 @@ static CRB_Value call_crowbar_function(CRB_Interpreter    *interpreter,
 
     DBG_assert(param == NULL, "...");
 
+    // 函数体中 global 语句创建的 GlobalVariableRef 分配在运行时存储器中,
+    // 由本次调用拥有, 返回时回退到这里一并回收.
+    // 实参在调用者的运行环境中求值, 其中的分配属于调用者, 所以在求值实参之后才记下位置.
+    // 全局变量本身不在运行时存储器中, 不受回退影响
+    MEM_StorageMark frame_mark = MEM_storage_mark(interpreter->execute_storage);
+
     StatementResult result = crb_execute_statement_list(interpreter, local_env, func->u.crowbar_f.block->statement_list);
 
     CRB_Value value;
@@ -591,34 +1090,62 @@ static CRB_Value call_crowbar_function(CRB_Interpreter    *interpreter,
         value.type = CRB_NULL_VALUE;
     }
 
+    crb_gc_pop_environment(interpreter, local_env);
     dispose_local_environment(local_env);
+    MEM_storage_release_to_mark(interpreter->execute_storage, frame_mark);
 
     return value;
 }
 
+/**
+ * 调用内置函数. receiver 不为 NULL 时是方法调用, 接收者作为第一个参数传入
+ */
 static CRB_Value
 call_native_function(CRB_Interpreter        *interpreter,
                      LocalEnvironment       *env,
-                     Expression             *expr,
+                     ArgumentList           *argument,
+                     CRB_Value              *receiver,
                      CRB_NativeFunctionProc  proc)
 {
-    int argc = 0;
-    for (ArgumentList *arg = expr->u.function_call_expression.argument;
-         arg != NULL; arg = arg->next) {
+    // 最后一个有副作用的实参之后的实参可以借用
+    int argc = (receiver != NULL) ? 1 : 0;
+    int last_side_effect = -1;
+    for (ArgumentList *arg = argument; arg != NULL; arg = arg->next) {
+        if (arg->expression->has_side_effect) {
+            last_side_effect = argc;
+        }
         argc++;
     }
 
-    CRB_Value *args = MEM_malloc(sizeof(CRB_Value) * argc);
+    CRB_Value *args = MEM_malloc((sizeof(CRB_Value) + sizeof(CRB_Boolean)) * argc);
+    CRB_Boolean *owned = (CRB_Boolean *)(args + argc);
 
     int i = 0;
-    for (ArgumentList *arg = expr->u.function_call_expression.argument;
-         arg != NULL; arg = arg->next) {
-        args[i++] = eval_expression(interpreter, env, arg->expression);
+    int root_top = interpreter->gc.root_num;
+    if (receiver != NULL) {
+        args[i] = *receiver;
+        owned[i] = CRB_TRUE;
+        crb_gc_push_root(interpreter, &args[i]);
+        i++;
+    }
+    for (ArgumentList *arg = argument; arg != NULL; arg = arg->next) {
+        if (i > last_side_effect) {
+            args[i] = eval_expression_borrowed(interpreter, env, arg->expression, &owned[i]);
+        }
+        else {
+            args[i] = eval_expression(interpreter, env, arg->expression);
+            owned[i] = CRB_TRUE;
+        }
+        crb_gc_push_root(interpreter, &args[i]);
+        i++;
     }
 
     CRB_Value value = proc(interpreter, argc, args);
+    crb_gc_pop_root(interpreter, root_top);
     for (i = 0; i < argc; i++) {
-        release_if_string(&args[i]);
+        if (owned[i]) {
+            crb_release_value(&args[i]);
+        }
     }
     MEM_free(args);
 
@@ -641,7 +1168,8 @@ eval_function_call_expression(CRB_Interpreter  *interpreter,
             value = call_crowbar_function(interpreter, env, expr, func);
             break;
         case NATIVE_FUNCTION_DEFINITION:
-            value = call_native_function(interpreter, env, expr, func->u.native_f.proc);
+            value = call_native_function(interpreter, env, expr->u.function_call_expression.argument,
+                                         NULL, func->u.native_f.proc);
             break;
         default:
             DBG_panic("Unexpected type");
@@ -650,6 +1178,94 @@ eval_function_call_expression(CRB_Interpreter  *interpreter,
     return value;
 }
 
+/**
+ * 求值内联的函数调用.
+ * 槽位数组相当于被调用函数的运行环境, 实参在调用者的槽位下求值, 之后切换到新的槽位
+ */
+static CRB_Value
+eval_inline_call_expression(CRB_Interpreter  *interpreter,
+                            LocalEnvironment *env,
+                            Expression       *expr)
+{
+    InlineCallExpression *call = &expr->u.inline_call_expression;
+    CRB_Value slot[INLINE_MAX_SLOT];
+    int i;
+
+    for (i = 0; i < call->slot_count; i++) {
+        slot[i].type = CRB_NULL_VALUE;
+    }
+    int root_top = interpreter->gc.root_num;
+    i = 0;
+    for (ArgumentList *arg = call->argument; arg != NULL; arg = arg->next, i++) {
+        slot[i] = eval_expression(interpreter, env, arg->expression);
+        crb_gc_push_root(interpreter, &slot[i]);
+    }
+
+    CRB_Value *caller_frame = interpreter->inline_frame;
+    interpreter->inline_frame = slot;
+    for (InlineAssignList *pos = call->assign; pos != NULL; pos = pos->next) {
+        CRB_Value value = eval_expression(interpreter, env, pos->value);
+        crb_release_value(&slot[pos->slot]);
+        slot[pos->slot] = value;
+        crb_gc_push_root(interpreter, &slot[pos->slot]);
+    }
+    CRB_Value value = eval_expression(interpreter, env, call->result);
+    interpreter->inline_frame = caller_frame;
+
+    crb_gc_pop_root(interpreter, root_top);
+    for (i = 0; i < call->slot_count; i++) {
+        crb_release_value(&slot[i]);
+    }
+    return value;
+}
+
+/**
+ * 在内置指针类型的方法表中按名字查找方法, 找不到时返回 NULL
+ */
+static CRB_NativeFunctionProc
+search_method(CRB_NativePointerInfo *info, const char *name)
+{
+    if (info->method == NULL) {
+        return NULL;
+    }
+    for (CRB_NativeMethod *pos = info->method; pos->name != NULL; pos++) {
+        if (!strcmp(pos->name, name)) {
+            return pos->proc;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * receiver.name(...), 接收者必须是内置指针.
+ * 调用点缓存上一次的接收者类型和方法: 同一调用点的接收者类型通常不变,
+ * 命中时只需比较一次指针, 不再按名字查找方法表
+ */
+static CRB_Value
+eval_method_call_expression(CRB_Interpreter  *interpreter,
+                            LocalEnvironment *env,
+                            Expression       *expr)
+{
+    MethodCallExpression *call = &expr->u.method_call_expression;
+    CRB_Value receiver = eval_expression(interpreter, env, call->receiver);
+
+    if (receiver.type != CRB_NATIVE_POINTER_VALUE) {
+        crb_runtime_error(expr->line_number, "method %s called on a non-native value", call->identifier);
+    }
+
+    CRB_NativePointerInfo *info = receiver.u.native_pointer.info;
+    if (call->cached_info != info) {
+        CRB_NativeFunctionProc proc = search_method(info, call->identifier);
+        if (proc == NULL) {
+            crb_runtime_error(expr->line_number, "%s has no method %s", info->name, call->identifier);
+        }
+        call->cached_info = info;
+        call->cached_proc = proc;
+    }
+
+    return call_native_function(interpreter, env, call->argument, &receiver, call->cached_proc);
+}
+
 /**
  * 将表达式分发到对应的处理函数上
  */
@@ -681,7 +1297,7 @@ static CRB_Value eval_expression(CRB_Interpreter  *interpreter,
             value = eval_identifier_expression(interpreter, env, expr);
             break;
         case ASSIGN_EXPRESSION:
-            value = eval_assign_expression(interpreter, env, expr->u.assign_expression.variable, expr->u.assign_expression.operand);
+            value = eval_assign_expression(interpreter, env, expr->u.assign_expression.left, expr->u.assign_expression.operand);
             break;
         case ADD_EXPRESSION:
         case SUB_EXPRESSION:
@@ -694,7 +1310,7 @@ static CRB_Value eval_expression(CRB_Interpreter  *interpreter,
         case GE_EXPRESSION:
         case LT_EXPRESSION:
         case LE_EXPRESSION:
-            value = crb_eval_binary_expression(interpreter, env, expr->type, expr->u.binary_expression.left, expr->u.binary_expression.right);
+            value = crb_eval_binary_expression(interpreter, env, expr->type, expr->u.binary_expression.left, expr->u.binary_expression.right, expr->is_temporary);
             break;
         case LOGICAL_AND_EXPRESSION:
         case LOGICAL_OR_EXPRESSION:
@@ -706,15 +1322,55 @@ static CRB_Value eval_expression(CRB_Interpreter  *interpreter,
         case FUNCTION_CALL_EXPRESSION:
             value = eval_function_call_expression(interpreter, env, expr);
             break;
+        case ARRAY_EXPRESSION:
+            value = eval_array_expression(interpreter, env, expr);
+            break;
+        case INDEX_EXPRESSION:
+            value = eval_index_expression(interpreter, env, expr);
+            break;
+        case MAP_EXPRESSION:
+            value = eval_map_expression(interpreter, env, expr);
+            break;
+        case ADD_ASSIGN_EXPRESSION:
+        case SUB_ASSIGN_EXPRESSION:
+        case MUL_ASSIGN_EXPRESSION:
+        case DIV_ASSIGN_EXPRESSION:
+        case INCREMENT_EXPRESSION:
+        case DECREMENT_EXPRESSION:
+            value = eval_update_expression(interpreter, env, expr);
+            break;
+        case METHOD_CALL_EXPRESSION:
+            value = eval_method_call_expression(interpreter, env, expr);
+            break;
+        case RECORD_EXPRESSION:
+            value = eval_record_expression(interpreter, env, expr);
+            break;
+        case FIELD_EXPRESSION:
+            value = eval_field_expression(interpreter, env, expr);
+            break;
+        case INLINE_CALL_EXPRESSION:
+            value = eval_inline_call_expression(interpreter, env, expr);
+            break;
+        case SLOT_EXPRESSION:
+            value = interpreter->inline_frame[expr->u.slot];
+            crb_refer_value(&value);
+            break;
         default:
             DBG_panic("Invalid expression!\n");
     }
     return value;
 }
 
+/**
+ * 语句中的表达式求值的入口.
+ * 求值期间分配在临时区中的字符串都只被父结点读取, 求值结束后一并回收
+ */
 CRB_Value crb_eval_expression(CRB_Interpreter  *interpreter,
                               LocalEnvironment *env,
                               Expression       *expr)
 {
-    return eval_expression(interpreter, env, expr);
+    MEM_StorageMark scratch_mark = MEM_storage_mark(interpreter->scratch_storage);
+    CRB_Value value = eval_expression(interpreter, env, expr);
+    MEM_storage_release_to_mark(interpreter->scratch_storage, scratch_mark);
+    return value;
 }
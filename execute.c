@@ -18,6 +18,17 @@ concat(concat(execute_, name), _statement) (CRB_Interpreter  *interpreter, \
                                             LocalEnvironment *env, \
                                             Statement        *statement)
 
+make_exec_helper(expression)
+{
+    StatementResult result = { .type = NORMAL_STATEMENT_RESULT };
+
+    // 表达式语句的值被丢弃, 释放它持有的引用
+    CRB_Value value = crb_eval_expression(interpreter, env, statement->u.expression_s);
+    crb_release_value(&value);
+
+    return result;
+}
+
 make_exec_helper(global)
 {
     StatementResult result = { .type = NORMAL_STATEMENT_RESULT };
@@ -135,7 +146,8 @@ make_exec_helper(for)
     StatementResult result = { .type = NORMAL_STATEMENT_RESULT };
 
     if (statement->u.for_s.init != NULL) {
-        crb_eval_expression(interpreter, env, statement->u.for_s.init);
+        CRB_Value init = crb_eval_expression(interpreter, env, statement->u.for_s.init);
+        crb_release_value(&init);
     }
 
     CRB_Value condition;
@@ -157,7 +169,8 @@ make_exec_helper(for)
         }
 
         if (statement->u.for_s.post != NULL) {
-            condition = crb_eval_expression(interpreter, env, statement->u.for_s.post);
+            CRB_Value post = crb_eval_expression(interpreter, env, statement->u.for_s.post);
+            crb_release_value(&post);
         }
     }
 
@@ -196,9 +209,12 @@ static StatementResult execute_statement(CRB_Interpreter  *interpreter,
         .type = NORMAL_STATEMENT_RESULT
     };
 
+    interpreter->current_line_number = statement->line_number;
+    crb_gc_safe_point(interpreter);
+
     switch (statement->type) {
         case EXPRESSION_STATEMENT:
-            crb_eval_expression(interpreter, env, statement->u.expression_s);
+            result = execute_expression_statement(interpreter, env, statement);
             break;
         case GLOBAL_STATEMENT:
             result = execute_global_statement(interpreter, env, statement);
@@ -0,0 +1,576 @@
+/**
+ * fold.c
+ * 常量折叠与死分支删除.
+ *
+ * const 定义的常量在编译期确定了值, 引用常量的标识符被替换成字面量,
+ * 之后操作数都是字面量的运算在编译期计算, 条件恒定的 if 和 while 只保留会执行的分支.
+ * 这样用常量表示的特性开关, 关闭的分支不会留下任何运行时开销.
+ * 折叠的结果与运行时求值一致, 运行时才能确定结果的表达式 (比如整数除以 0) 保持原样.
+ */
+
+#include "crowbar.h"
+#include "DBG.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void fold_statement_list(StatementList **list);
+
+ConstantDefinition *
+crb_search_constant(const char *name)
+{
+    for (ConstantDefinition *pos = crb_get_current_interpreter()->constant_list;
+         pos != NULL; pos = pos->next) {
+        if (!strcmp(pos->name, name)) {
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+static void
+check_not_constant(const char *name, int line_number, const char *usage)
+{
+    if (crb_search_constant(name) != NULL) {
+        fprintf(stderr, "Line %d: constant %s can not be used as %s\n",
+                line_number, name, usage);
+        exit(1);
+    }
+}
+
+static CRB_Boolean
+is_boolean_literal(Expression *expr, CRB_Boolean value)
+{
+    return expr->type == BOOLEAN_EXPRESSION && expr->u.boolean_value == value;
+}
+
+static CRB_Boolean
+is_number_literal(Expression *expr)
+{
+    return expr->type == INT_EXPRESSION || expr->type == DOUBLE_EXPRESSION;
+}
+
+static CRB_Boolean
+is_literal(Expression *expr)
+{
+    return is_number_literal(expr) || expr->type == STRING_EXPRESSION
+           || expr->type == BOOLEAN_EXPRESSION || expr->type == NULL_EXPRESSION;
+}
+
+static double
+number_literal_value(Expression *expr)
+{
+    return expr->type == INT_EXPRESSION ? expr->u.int_value : expr->u.double_value;
+}
+
+static void
+set_int_literal(Expression *expr, int value)
+{
+    expr->type = INT_EXPRESSION;
+    expr->has_side_effect = CRB_FALSE;
+    expr->u.int_value = value;
+}
+
+static void
+set_double_literal(Expression *expr, double value)
+{
+    expr->type = DOUBLE_EXPRESSION;
+    expr->has_side_effect = CRB_FALSE;
+    expr->u.double_value = value;
+}
+
+static void
+set_boolean_literal(Expression *expr, CRB_Boolean value)
+{
+    expr->type = BOOLEAN_EXPRESSION;
+    expr->has_side_effect = CRB_FALSE;
+    expr->u.boolean_value = value;
+}
+
+static CRB_Boolean
+compare_result(ExpressionType type, int cmp)
+{
+    switch (type) {
+        case EQ_EXPRESSION:
+            return cmp == 0 ? CRB_TRUE : CRB_FALSE;
+        case NE_EXPRESSION:
+            return cmp != 0 ? CRB_TRUE : CRB_FALSE;
+        case GT_EXPRESSION:
+            return cmp > 0 ? CRB_TRUE : CRB_FALSE;
+        case GE_EXPRESSION:
+            return cmp >= 0 ? CRB_TRUE : CRB_FALSE;
+        case LT_EXPRESSION:
+            return cmp < 0 ? CRB_TRUE : CRB_FALSE;
+        case LE_EXPRESSION:
+            return cmp <= 0 ? CRB_TRUE : CRB_FALSE;
+        default:
+            DBG_panic("bad case %d", type);
+    }
+    return CRB_FALSE;
+}
+
+static CRB_Boolean
+is_compare_operator(ExpressionType type)
+{
+    return type == EQ_EXPRESSION || type == NE_EXPRESSION || type == GT_EXPRESSION
+           || type == GE_EXPRESSION || type == LT_EXPRESSION || type == LE_EXPRESSION;
+}
+
+/**
+ * 整数运算按运行时的结果回绕, 除以 0 和 INT_MIN / -1 留给运行时
+ */
+static void
+fold_binary_int(Expression *expr, int left, int right)
+{
+    ExpressionType type = expr->type;
+
+    if (is_compare_operator(type)) {
+        set_boolean_literal(expr, compare_result(type, (left > right) - (left < right)));
+        return;
+    }
+    if ((type == DIV_EXPRESSION || type == MOD_EXPRESSION)
+            && (right == 0 || (left == INT_MIN && right == -1))) {
+        return;
+    }
+
+    unsigned int l = left;
+    unsigned int r = right;
+    switch (type) {
+        case ADD_EXPRESSION:
+            set_int_literal(expr, (int)(l + r));
+            break;
+        case SUB_EXPRESSION:
+            set_int_literal(expr, (int)(l - r));
+            break;
+        case MUL_EXPRESSION:
+            set_int_literal(expr, (int)(l * r));
+            break;
+        case DIV_EXPRESSION:
+            set_int_literal(expr, left / right);
+            break;
+        case MOD_EXPRESSION:
+            set_int_literal(expr, left % right);
+            break;
+        default:
+            DBG_panic("bad case %d", type);
+    }
+}
+
+static void
+fold_binary_double(Expression *expr, double left, double right)
+{
+    ExpressionType type = expr->type;
+
+    if (is_compare_operator(type)) {
+        // 与运行时一样直接比较, NaN 参与的比较除了 != 都为假
+        CRB_Boolean result = CRB_FALSE;
+        switch (type) {
+            case EQ_EXPRESSION: result = left == right; break;
+            case NE_EXPRESSION: result = left != right; break;
+            case GT_EXPRESSION: result = left > right; break;
+            case GE_EXPRESSION: result = left >= right; break;
+            case LT_EXPRESSION: result = left < right; break;
+            case LE_EXPRESSION: result = left <= right; break;
+            default: break;
+        }
+        set_boolean_literal(expr, result);
+        return;
+    }
+
+    switch (type) {
+        case ADD_EXPRESSION:
+            set_double_literal(expr, left + right);
+            break;
+        case SUB_EXPRESSION:
+            set_double_literal(expr, left - right);
+            break;
+        case MUL_EXPRESSION:
+            set_double_literal(expr, left * right);
+            break;
+        case DIV_EXPRESSION:
+            set_double_literal(expr, left / right);
+            break;
+        case MOD_EXPRESSION:
+            set_double_literal(expr, fmod(left, right));
+            break;
+        default:
+            DBG_panic("bad case %d", type);
+    }
+}
+
+/**
+ * 字符串连接字面量, 右操作数的格式与运行时的 concat_operand_chars 相同
+ */
+static void
+fold_concat(Expression *expr, const char *left, Expression *right)
+{
+    char buf[LINE_BUF_SIZE];
+    const char *right_chars = buf;
+
+    switch (right->type) {
+        case INT_EXPRESSION:
+            snprintf(buf, sizeof(buf), "%d", right->u.int_value);
+            break;
+        case DOUBLE_EXPRESSION:
+            snprintf(buf, sizeof(buf), "%f", right->u.double_value);
+            break;
+        case BOOLEAN_EXPRESSION:
+            right_chars = right->u.boolean_value ? "true" : "false";
+            break;
+        case STRING_EXPRESSION:
+            right_chars = right->u.string_value;
+            break;
+        case NULL_EXPRESSION:
+            right_chars = "null";
+            break;
+        default:
+            return;
+    }
+
+    size_t left_len = strlen(left);
+    size_t right_len = strlen(right_chars);
+    char *str = crb_malloc(left_len + right_len + 1);
+    memcpy(str, left, left_len);
+    memcpy(str + left_len, right_chars, right_len + 1);
+
+    expr->type = STRING_EXPRESSION;
+    expr->has_side_effect = CRB_FALSE;
+    expr->u.string_value = str;
+}
+
+static void
+fold_binary_expression(Expression *expr)
+{
+    Expression *left = expr->u.binary_expression.left;
+    Expression *right = expr->u.binary_expression.right;
+    ExpressionType type = expr->type;
+
+    crb_fold_expression(left);
+    crb_fold_expression(right);
+
+    if (left->type == INT_EXPRESSION && right->type == INT_EXPRESSION) {
+        fold_binary_int(expr, left->u.int_value, right->u.int_value);
+    }
+    else if (is_number_literal(left) && is_number_literal(right)) {
+        fold_binary_double(expr, number_literal_value(left), number_literal_value(right));
+    }
+    else if (left->type == BOOLEAN_EXPRESSION && right->type == BOOLEAN_EXPRESSION
+             && (type == EQ_EXPRESSION || type == NE_EXPRESSION)) {
+        set_boolean_literal(expr, compare_result(type, left->u.boolean_value != right->u.boolean_value));
+    }
+    else if (left->type == STRING_EXPRESSION && type == ADD_EXPRESSION) {
+        fold_concat(expr, left->u.string_value, right);
+    }
+    else if (left->type == STRING_EXPRESSION && right->type == STRING_EXPRESSION
+             && is_compare_operator(type)) {
+        set_boolean_literal(expr, compare_result(type, strcmp(left->u.string_value, right->u.string_value)));
+    }
+    else if ((left->type == NULL_EXPRESSION || right->type == NULL_EXPRESSION)
+             && is_literal(left) && is_literal(right)
+             && (type == EQ_EXPRESSION || type == NE_EXPRESSION)) {
+        CRB_Boolean both_null = left->type == NULL_EXPRESSION && right->type == NULL_EXPRESSION;
+        set_boolean_literal(expr, compare_result(type, both_null ? 0 : 1));
+    }
+}
+
+/**
+ * 左操作数确定时 && 和 || 可能短路, 不求值的右操作数直接丢弃
+ */
+static void
+fold_logical_expression(Expression *expr)
+{
+    Expression *left = expr->u.binary_expression.left;
+    Expression *right = expr->u.binary_expression.right;
+
+    crb_fold_expression(left);
+    crb_fold_expression(right);
+
+    if (left->type != BOOLEAN_EXPRESSION) {
+        return;
+    }
+    if (expr->type == LOGICAL_AND_EXPRESSION && left->u.boolean_value == CRB_FALSE) {
+        set_boolean_literal(expr, CRB_FALSE);
+    }
+    else if (expr->type == LOGICAL_OR_EXPRESSION && left->u.boolean_value == CRB_TRUE) {
+        set_boolean_literal(expr, CRB_TRUE);
+    }
+    else if (right->type == BOOLEAN_EXPRESSION) {
+        set_boolean_literal(expr, right->u.boolean_value);
+    }
+}
+
+static void
+fold_minus_expression(Expression *expr)
+{
+    Expression *operand = expr->u.minus_expression;
+
+    crb_fold_expression(operand);
+    if (operand->type == INT_EXPRESSION) {
+        set_int_literal(expr, (int)(0u - (unsigned int)operand->u.int_value));
+    }
+    else if (operand->type == DOUBLE_EXPRESSION) {
+        set_double_literal(expr, -operand->u.double_value);
+    }
+}
+
+// 左值本身不折叠, 只折叠下标和字段访问的子表达式
+static void
+fold_left_value(Expression *left)
+{
+    if (left->type == IDENTIFIER_EXPRESSION) {
+        check_not_constant(left->u.identifier, left->line_number, "left value");
+    }
+    else if (left->type == INDEX_EXPRESSION) {
+        crb_fold_expression(left->u.index_expression.array);
+        crb_fold_expression(left->u.index_expression.index);
+    }
+    else if (left->type == FIELD_EXPRESSION) {
+        crb_fold_expression(left->u.field_expression.record);
+    }
+}
+
+static void
+fold_argument_list(ArgumentList *list)
+{
+    for (ArgumentList *pos = list; pos != NULL; pos = pos->next) {
+        crb_fold_expression(pos->expression);
+    }
+}
+
+void
+crb_fold_expression(Expression *expr)
+{
+    if (expr == NULL) {
+        return;
+    }
+
+    switch (expr->type) {
+        case IDENTIFIER_EXPRESSION: {
+            ConstantDefinition *constant = crb_search_constant(expr->u.identifier);
+            if (constant != NULL) {
+                int line_number = expr->line_number;
+                *expr = *constant->value;
+                expr->line_number = line_number;
+            }
+            break;
+        }
+        case ADD_EXPRESSION:
+        case SUB_EXPRESSION:
+        case MUL_EXPRESSION:
+        case DIV_EXPRESSION:
+        case MOD_EXPRESSION:
+        case EQ_EXPRESSION:
+        case NE_EXPRESSION:
+        case GT_EXPRESSION:
+        case GE_EXPRESSION:
+        case LT_EXPRESSION:
+        case LE_EXPRESSION:
+            fold_binary_expression(expr);
+            break;
+        case LOGICAL_AND_EXPRESSION:
+        case LOGICAL_OR_EXPRESSION:
+            fold_logical_expression(expr);
+            break;
+        case MINUS_EXPRESSION:
+            fold_minus_expression(expr);
+            break;
+        case ASSIGN_EXPRESSION:
+        case ADD_ASSIGN_EXPRESSION:
+        case SUB_ASSIGN_EXPRESSION:
+        case MUL_ASSIGN_EXPRESSION:
+        case DIV_ASSIGN_EXPRESSION:
+            fold_left_value(expr->u.assign_expression.left);
+            crb_fold_expression(expr->u.assign_expression.operand);
+            break;
+        case INCREMENT_EXPRESSION:
+        case DECREMENT_EXPRESSION:
+            fold_left_value(expr->u.inc_dec);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            fold_argument_list(expr->u.function_call_expression.argument);
+            break;
+        case METHOD_CALL_EXPRESSION:
+            crb_fold_expression(expr->u.method_call_expression.receiver);
+            fold_argument_list(expr->u.method_call_expression.argument);
+            break;
+        case ARRAY_EXPRESSION:
+            for (ExpressionList *pos = expr->u.array_literal; pos != NULL; pos = pos->next) {
+                crb_fold_expression(pos->expression);
+            }
+            break;
+        case INDEX_EXPRESSION:
+            crb_fold_expression(expr->u.index_expression.array);
+            crb_fold_expression(expr->u.index_expression.index);
+            break;
+        case MAP_EXPRESSION:
+            for (KeyValueList *pos = expr->u.map_literal; pos != NULL; pos = pos->next) {
+                crb_fold_expression(pos->key);
+                crb_fold_expression(pos->value);
+            }
+            break;
+        case RECORD_EXPRESSION:
+            for (FieldInitList *pos = expr->u.record_literal.field; pos != NULL; pos = pos->next) {
+                crb_fold_expression(pos->value);
+            }
+            break;
+        case FIELD_EXPRESSION:
+            crb_fold_expression(expr->u.field_expression.record);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+fold_block(Block *block)
+{
+    if (block != NULL) {
+        fold_statement_list(&block->statement_list);
+    }
+}
+
+/**
+ * 去掉不会执行的分支. 条件恒真时 if 语句展开成分支中的语句,
+ * crowbar 的块没有自己的作用域, 展开不改变语义
+ */
+static StatementList *
+fold_if_statement(StatementList *node)
+{
+    IfStatement *if_s = &node->statement->u.if_s;
+
+    crb_fold_expression(if_s->condition);
+    fold_block(if_s->then_block);
+    for (Elsif *pos = if_s->elsif_list; pos != NULL; pos = pos->next) {
+        crb_fold_expression(pos->condition);
+        fold_block(pos->block);
+    }
+    fold_block(if_s->else_block);
+
+    // 恒假的 elsif 不会执行, 恒真的 elsif 之后的分支也不会执行
+    for (Elsif **pos = &if_s->elsif_list; *pos != NULL; ) {
+        if (is_boolean_literal((*pos)->condition, CRB_FALSE)) {
+            *pos = (*pos)->next;
+        }
+        else if (is_boolean_literal((*pos)->condition, CRB_TRUE)) {
+            (*pos)->next = NULL;
+            if_s->else_block = NULL;
+            break;
+        }
+        else {
+            pos = &(*pos)->next;
+        }
+    }
+
+    // 条件恒假时由下一个分支顶替
+    while (is_boolean_literal(if_s->condition, CRB_FALSE)) {
+        if (if_s->elsif_list != NULL) {
+            if_s->condition = if_s->elsif_list->condition;
+            if_s->then_block = if_s->elsif_list->block;
+            if_s->elsif_list = if_s->elsif_list->next;
+        }
+        else {
+            return if_s->else_block != NULL ? if_s->else_block->statement_list : NULL;
+        }
+    }
+
+    if (is_boolean_literal(if_s->condition, CRB_TRUE)) {
+        return if_s->then_block->statement_list;
+    }
+    return node;
+}
+
+/**
+ * 折叠一条语句, 返回替换它的语句链表:
+ * 通常是它自己, 不会执行的语句是 NULL, 展开的 if 语句是分支中的语句
+ */
+static StatementList *
+fold_statement(StatementList *node)
+{
+    Statement *statement = node->statement;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            crb_fold_expression(statement->u.expression_s);
+            break;
+        case GLOBAL_STATEMENT:
+            for (IdentifierList *pos = statement->u.global_s.identifier_list;
+                 pos != NULL; pos = pos->next) {
+                check_not_constant(pos->name, statement->line_number, "global variable");
+            }
+            break;
+        case IF_STATEMENT:
+            return fold_if_statement(node);
+        case WHILE_STATEMENT:
+            crb_fold_expression(statement->u.while_s.condition);
+            fold_block(statement->u.while_s.block);
+            if (is_boolean_literal(statement->u.while_s.condition, CRB_FALSE)) {
+                return NULL;
+            }
+            break;
+        case FOR_STATEMENT: {
+            Expression *init = statement->u.for_s.init;
+            crb_fold_expression(init);
+            crb_fold_expression(statement->u.for_s.condition);
+            crb_fold_expression(statement->u.for_s.post);
+            fold_block(statement->u.for_s.block);
+            // 条件恒假时只剩下初始化表达式
+            if (statement->u.for_s.condition != NULL
+                    && is_boolean_literal(statement->u.for_s.condition, CRB_FALSE)) {
+                if (init == NULL) {
+                    return NULL;
+                }
+                statement->type = EXPRESSION_STATEMENT;
+                statement->u.expression_s = init;
+            }
+            break;
+        }
+        case RETURN_STATEMENT:
+            crb_fold_expression(statement->u.return_s.return_value);
+            break;
+        default:
+            break;
+    }
+    return node;
+}
+
+static void
+fold_statement_list(StatementList **list)
+{
+    StatementList **pos = list;
+
+    while (*pos != NULL) {
+        StatementList *node = *pos;
+        StatementList *replacement = fold_statement(node);
+        if (replacement == node) {
+            pos = &node->next;
+            continue;
+        }
+        // 替换的语句已经折叠过, 接在原来的位置上
+        StatementList *next = node->next;
+        *pos = replacement;
+        while (*pos != NULL) {
+            pos = &(*pos)->next;
+        }
+        *pos = next;
+    }
+}
+
+void
+crb_fold_constants(CRB_Interpreter *interpreter)
+{
+    fold_statement_list(&interpreter->statement_list);
+    for (FunctionDefinition *func = interpreter->function_list; func != NULL; func = func->next) {
+        if (func->type != CROWBAR_FUNCTION_DEFINITION) {
+            continue;
+        }
+        for (ParameterList *param = func->u.crowbar_f.parameter; param != NULL; param = param->next) {
+            if (crb_search_constant(param->name) != NULL) {
+                fprintf(stderr, "function %s: constant %s can not be used as parameter\n",
+                        func->name, param->name);
+                exit(1);
+            }
+        }
+        fold_block(func->u.crowbar_f.block);
+    }
+}
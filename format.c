@@ -0,0 +1,184 @@
+/**
+ * format.c
+ * 容器的文本表示, print 和字符串连接共用.
+ */
+
+#include "crowbar.h"
+#include <string.h>
+
+// 最大嵌套深度, 防止嵌套很深的容器耗尽 C 栈
+#define CONTAINER_TO_STRING_MAX_DEPTH (1024)
+
+/**
+ * 可增长的文本缓冲区
+ */
+typedef struct {
+    char *buf;
+    int   length;
+    int   capacity;
+} TextBuffer;
+
+/**
+ * 从最外层到当前位置的容器. 循环引用的容器回到路径上时输出 "...",
+ * 只按深度截断的话, 多处引用自身的容器要遍历的结点数随深度指数增长
+ */
+typedef struct {
+    CRB_Object *container[CONTAINER_TO_STRING_MAX_DEPTH];
+    int         depth;
+} ContainerPath;
+
+static void
+append_text(TextBuffer *text, const char *str, int len)
+{
+    if (text->length + len + 1 > text->capacity) {
+        text->capacity = max(text->capacity * 2, text->length + len + 1);
+        text->buf = MEM_realloc(text->buf, text->capacity);
+    }
+    memcpy(text->buf + text->length, str, len);
+    text->length += len;
+}
+
+// 可能引用其他值的容器的公共头部, 其他值返回 NULL
+static CRB_Object *
+container_header(CRB_Value *value)
+{
+    switch (value->type) {
+        case CRB_ARRAY_VALUE:
+            return &value->u.array_value->header;
+        case CRB_MAP_VALUE:
+            return &value->u.map_value->header;
+        case CRB_RECORD_VALUE:
+            return &value->u.record_value->header;
+        default:
+            return NULL;
+    }
+}
+
+// 把容器压入路径, 容器已经在路径上或路径已满时返回 CRB_FALSE
+static CRB_Boolean
+enter_container(ContainerPath *path, CRB_Object *container)
+{
+    if (path->depth == CONTAINER_TO_STRING_MAX_DEPTH) {
+        return CRB_FALSE;
+    }
+    for (int i = 0; i < path->depth; i++) {
+        if (path->container[i] == container) {
+            return CRB_FALSE;
+        }
+    }
+    path->container[path->depth++] = container;
+    return CRB_TRUE;
+}
+
+static void
+append_value(TextBuffer *text, CRB_Value *value, ContainerPath *path)
+{
+    char buf[LINE_BUF_SIZE];
+    int len = 0;
+
+    CRB_Object *container = container_header(value);
+    if (container != NULL && !enter_container(path, container)) {
+        append_text(text, "...", 3);
+        return;
+    }
+
+    switch (value->type) {
+        case CRB_INT_VALUE:
+            len = sprintf(buf, "%d", value->u.int_value);
+            break;
+        case CRB_DOUBLE_VALUE:
+            len = sprintf(buf, "%f", value->u.double_value);
+            break;
+        case CRB_BOOLEAN_VALUE:
+            len = sprintf(buf, "%s", (value->u.boolean_value == CRB_TRUE) ? "true" : "false");
+            break;
+        case CRB_STRING_VALUE:
+            append_text(text, value->u.string_value->string, value->u.string_value->length);
+            break;
+        case CRB_NATIVE_POINTER_VALUE:
+            len = snprintf(buf, sizeof(buf), "(%s:%p)", value->u.native_pointer.info->name,
+                           value->u.native_pointer.pointer);
+            break;
+        case CRB_NULL_VALUE:
+            len = sprintf(buf, "null");
+            break;
+        case CRB_ARRAY_VALUE: {
+            CRB_Array *array = value->u.array_value;
+            append_text(text, "(", 1);
+            for (int i = 0; i < array->size; i++) {
+                if (i > 0) {
+                    append_text(text, ", ", 2);
+                }
+                append_value(text, &array->element[i], path);
+            }
+            append_text(text, ")", 1);
+            break;
+        }
+        case CRB_MAP_VALUE: {
+            CRB_Map *map = value->u.map_value;
+            int n = 0;
+            append_text(text, "{", 1);
+            for (int i = 0; i < map->capacity; i++) {
+                MapEntry *entry = &map->entry[i];
+                if (entry->distance == 0) {
+                    continue;
+                }
+                if (n++ > 0) {
+                    append_text(text, ", ", 2);
+                }
+                append_value(text, &entry->key, path);
+                append_text(text, ": ", 2);
+                append_value(text, &entry->value, path);
+            }
+            append_text(text, "}", 1);
+            break;
+        }
+        case CRB_RECORD_VALUE: {
+            CRB_Record *record = value->u.record_value;
+            append_text(text, "{", 1);
+            for (int i = 0; i < record->shape->field_count; i++) {
+                if (i > 0) {
+                    append_text(text, ", ", 2);
+                }
+                append_text(text, ".", 1);
+                append_text(text, record->shape->field_name[i], strlen(record->shape->field_name[i]));
+                append_text(text, " = ", 3);
+                append_value(text, &record->field[i], path);
+            }
+            append_text(text, "}", 1);
+            break;
+        }
+        case CRB_TYPED_ARRAY_VALUE: {
+            CRB_TypedArray *array = value->u.typed_array_value;
+            append_text(text, "(", 1);
+            for (int i = 0; i < array->size; i++) {
+                if (i > 0) {
+                    append_text(text, ", ", 2);
+                }
+                CRB_Value element = crb_typed_array_get(array, i);
+                append_value(text, &element, path);
+            }
+            append_text(text, ")", 1);
+            break;
+        }
+    }
+    append_text(text, buf, len);
+    if (container != NULL) {
+        path->depth--;
+    }
+}
+
+CRB_String *
+crb_container_to_string(CRB_Value *value)
+{
+    TextBuffer text = { .buf = NULL, .length = 0, .capacity = 0 };
+    ContainerPath path;
+    path.depth = 0;
+    append_value(&text, value, &path);
+
+    CRB_String *ret = crb_alloc_crb_string(text.length);
+    memcpy(ret->string, text.buf, text.length);
+    ret->string[text.length] = '\0';
+    MEM_free(text.buf);
+    return ret;
+}
@@ -0,0 +1,456 @@
+/**
+ * gc.c
+ * 运行时字符串和容器的精确标记-清除回收器.
+ *
+ * 开启后所有新建的字符串和容器都登记在对象链表中, 引用计数不再维护.
+ * 分配量超过阈值时只设置请求, 真正的回收推迟到下一个语句边界 (安全点),
+ * 这样表达式求值中途持有的 C 局部变量不会被回收,
+ * 只有跨越函数调用 (函数体中有安全点) 存活的临时值需要压入根栈.
+ *
+ * 一轮回收: 翻转 black 使所有对象变白, 标记, 然后清除白色对象.
+ * 标记和清除都可以按时间片分成多段. 标记期间新建的对象直接取 black (分配即黑),
+ * 存入容器的值经过写屏障涂灰, 所以已经扫描过的容器不会引用白色对象.
+ * 根 (变量, 运行环境, 根栈) 没有写屏障, 灰色容器处理完后重新扫描根,
+ * 没有新的灰色容器时标记完成. 这时白色对象已经不可达, 程序不会再碰到它们,
+ * 所以分段清除也是安全的.
+ * 存活对象不需要清除标记, 下一轮翻转 black 后它们自然变白.
+ */
+
+// clock_gettime
+#define _GNU_SOURCE
+
+#include "crowbar.h"
+#include "DBG.h"
+#include <string.h>
+#include <time.h>
+
+// 第一次回收之前允许分配的字节数
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+
+// 回收后的阈值是存活字节数的倍数, 使回收的摊还代价与分配量成正比
+#define GC_THRESHOLD_FACTOR (2)
+
+#define GC_ROOT_INIT_CAPACITY (64)
+
+#define GC_GRAY_INIT_CAPACITY (256)
+
+// 每处理这么多个对象 (标记阶段是容器的元素) 检查一次时间
+#define GC_CHECK_INTERVAL (64)
+
+static long
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void
+crb_gc_register_string(CRB_Interpreter *interpreter, CRB_String *str, size_t bytes)
+{
+    GarbageCollector *gc = &interpreter->gc;
+    str->marked = gc->black;
+    str->gc_next = gc->object_list;
+    gc->object_list = str;
+    gc->allocated_bytes += bytes;
+}
+
+void
+crb_gc_register_container(CRB_Interpreter *interpreter, CRB_Object *container, size_t bytes)
+{
+    GarbageCollector *gc = &interpreter->gc;
+    container->marked = gc->black;
+    container->gc_next = gc->container_list;
+    gc->container_list = container;
+    gc->allocated_bytes += bytes;
+}
+
+void
+crb_gc_revive_string(CRB_Interpreter *interpreter, CRB_String *str)
+{
+    if (interpreter->gc.enabled) {
+        str->marked = interpreter->gc.black;
+    }
+}
+
+void
+crb_gc_add_bytes(CRB_Interpreter *interpreter, size_t bytes)
+{
+    interpreter->gc.allocated_bytes += bytes;
+}
+
+int
+crb_gc_push_root(CRB_Interpreter *interpreter, CRB_Value *value)
+{
+    GarbageCollector *gc = &interpreter->gc;
+    int top = gc->root_num;
+
+    if (!gc->enabled) {
+        return top;
+    }
+    if (gc->root_num == gc->root_capacity) {
+        gc->root_capacity = (gc->root_capacity == 0) ? GC_ROOT_INIT_CAPACITY : gc->root_capacity * 2;
+        gc->root = MEM_realloc(gc->root, sizeof(CRB_Value) * gc->root_capacity);
+    }
+    gc->root[gc->root_num++] = *value;
+    return top;
+}
+
+void
+crb_gc_pop_root(CRB_Interpreter *interpreter, int top)
+{
+    DBG_assert(top <= interpreter->gc.root_num, "bad root stack top");
+    interpreter->gc.root_num = top;
+}
+
+void
+crb_gc_push_environment(CRB_Interpreter *interpreter, LocalEnvironment *env)
+{
+    env->caller = interpreter->gc.env_top;
+    interpreter->gc.env_top = env;
+}
+
+void
+crb_gc_pop_environment(CRB_Interpreter *interpreter, LocalEnvironment *env)
+{
+    DBG_assert(interpreter->gc.env_top == env, "environment stack mismatch");
+    interpreter->gc.env_top = env->caller;
+}
+
+static void
+mark_string(CRB_String *str, CRB_Boolean black)
+{
+    str->marked = black;
+    // 视图总是直接引用根字符串, 不会形成链
+    if (str->parent != NULL) {
+        str->parent->marked = black;
+    }
+}
+
+static inline CRB_Boolean
+out_of_time(int *count, long deadline)
+{
+    return (deadline != 0 && ++*count % GC_CHECK_INTERVAL == 0 && now_ns() >= deadline) ?
+           CRB_TRUE : CRB_FALSE;
+}
+
+// 容器涂灰: 先涂黑 (marked 取 black) 再压入灰栈, 稍后扫描它的元素.
+// 已经标记过的容器不再压栈, 循环引用也能终止
+static void
+push_gray(GarbageCollector *gc, CRB_Object *container)
+{
+    if (container->marked == gc->black) {
+        return;
+    }
+    container->marked = gc->black;
+    if (gc->gray_num == gc->gray_capacity) {
+        gc->gray_capacity = (gc->gray_capacity == 0) ? GC_GRAY_INIT_CAPACITY : gc->gray_capacity * 2;
+        gc->gray = MEM_realloc(gc->gray, sizeof(CRB_Object *) * gc->gray_capacity);
+    }
+    gc->gray[gc->gray_num++] = container;
+}
+
+static void
+shade_value(GarbageCollector *gc, CRB_Value *value)
+{
+    if (value->type == CRB_STRING_VALUE) {
+        mark_string(value->u.string_value, gc->black);
+    }
+    else if (value->type == CRB_ARRAY_VALUE) {
+        push_gray(gc, &value->u.array_value->header);
+    }
+    else if (value->type == CRB_MAP_VALUE) {
+        push_gray(gc, &value->u.map_value->header);
+    }
+    else if (value->type == CRB_RECORD_VALUE) {
+        push_gray(gc, &value->u.record_value->header);
+    }
+    else if (value->type == CRB_TYPED_ARRAY_VALUE) {
+        // 数值数组不引用其他对象
+        value->u.typed_array_value->header.marked = gc->black;
+    }
+}
+
+void
+crb_gc_write_barrier(CRB_Interpreter *interpreter, CRB_Value *value)
+{
+    if (interpreter->gc.marking) {
+        shade_value(&interpreter->gc, value);
+    }
+}
+
+// 从 scan_index 处继续扫描 scan_object 的元素, 时间用完时记下进度返回 CRB_FALSE.
+// 每次都重新读取元素数组, 扫描中途容器增长也没有关系
+static CRB_Boolean
+scan_container(GarbageCollector *gc, int *count, long deadline)
+{
+    CRB_Object *container = gc->scan_object;
+
+    if (container->type == CRB_ARRAY_VALUE) {
+        CRB_Array *array = (CRB_Array *)container;
+        while (gc->scan_index < array->size) {
+            shade_value(gc, &array->element[gc->scan_index++]);
+            if (out_of_time(count, deadline)) {
+                return CRB_FALSE;
+            }
+        }
+    }
+    else if (container->type == CRB_MAP_VALUE) {
+        // 插入和删除会移动映射的项, 移动的项都经过写屏障, 不会因为移到扫描过的位置而漏标
+        CRB_Map *map = (CRB_Map *)container;
+        while (gc->scan_index < map->capacity) {
+            MapEntry *entry = &map->entry[gc->scan_index++];
+            if (entry->distance != 0) {
+                shade_value(gc, &entry->key);
+                shade_value(gc, &entry->value);
+            }
+            if (out_of_time(count, deadline)) {
+                return CRB_FALSE;
+            }
+        }
+    }
+    else {
+        CRB_Record *record = (CRB_Record *)container;
+        while (gc->scan_index < record->shape->field_count) {
+            shade_value(gc, &record->field[gc->scan_index++]);
+            if (out_of_time(count, deadline)) {
+                return CRB_FALSE;
+            }
+        }
+    }
+    return CRB_TRUE;
+}
+
+static void
+mark_variable_list(GarbageCollector *gc, Variable *variable)
+{
+    for (Variable *pos = variable; pos != NULL; pos = pos->next) {
+        shade_value(gc, &pos->value);
+    }
+}
+
+static void
+mark_roots(CRB_Interpreter *interpreter)
+{
+    GarbageCollector *gc = &interpreter->gc;
+
+    mark_variable_list(gc, interpreter->variable);
+    for (LocalEnvironment *env = gc->env_top; env != NULL; env = env->caller) {
+        mark_variable_list(gc, env->variable);
+    }
+    for (int i = 0; i < gc->root_num; i++) {
+        shade_value(gc, &gc->root[i]);
+    }
+}
+
+// 开始新的一轮: 所有对象变白, 标记根, 进入标记阶段
+static void
+start_cycle(CRB_Interpreter *interpreter)
+{
+    GarbageCollector *gc = &interpreter->gc;
+
+    gc->black = !gc->black;
+    gc->marking = CRB_TRUE;
+    gc->allocated_bytes = 0;
+    gc->sweep_live_bytes = 0;
+    mark_roots(interpreter);
+}
+
+// 标记一段, deadline 为 0 时一直标记到结束. 标记完成后进入清除阶段
+static void
+mark(CRB_Interpreter *interpreter, long deadline)
+{
+    GarbageCollector *gc = &interpreter->gc;
+    int count = 0;
+
+    for (;;) {
+        // 用灰栈代替递归, 嵌套很深的容器也不会耗尽 C 栈
+        while (gc->scan_object != NULL || gc->gray_num > 0) {
+            if (gc->scan_object == NULL) {
+                gc->scan_object = gc->gray[--gc->gray_num];
+                gc->scan_index = 0;
+            }
+            if (!scan_container(gc, &count, deadline)) {
+                return;
+            }
+            gc->scan_object = NULL;
+        }
+        mark_roots(interpreter);
+        if (gc->gray_num == 0) {
+            break;
+        }
+    }
+
+    gc->marking = CRB_FALSE;
+    gc->sweep_pos = &gc->object_list;
+    gc->container_sweep_pos = &gc->container_list;
+}
+
+static void
+finish_cycle(GarbageCollector *gc)
+{
+    gc->sweep_pos = NULL;
+    gc->container_sweep_pos = NULL;
+    gc->stats.live_bytes = gc->sweep_live_bytes;
+    gc->stats.cycle_count++;
+    gc->threshold = max(GC_INITIAL_THRESHOLD, gc->sweep_live_bytes * GC_THRESHOLD_FACTOR);
+}
+
+static size_t
+container_bytes(CRB_Object *container)
+{
+    if (container->type == CRB_ARRAY_VALUE) {
+        return crb_array_bytes((CRB_Array *)container);
+    }
+    else if (container->type == CRB_MAP_VALUE) {
+        return crb_map_bytes((CRB_Map *)container);
+    }
+    else if (container->type == CRB_RECORD_VALUE) {
+        return crb_record_bytes((CRB_Record *)container);
+    }
+    else {
+        return crb_typed_array_bytes((CRB_TypedArray *)container);
+    }
+}
+
+static void
+dispose_container(CRB_Object *container)
+{
+    if (container->type == CRB_ARRAY_VALUE) {
+        crb_dispose_array((CRB_Array *)container);
+    }
+    else if (container->type == CRB_MAP_VALUE) {
+        crb_dispose_map((CRB_Map *)container);
+    }
+    else if (container->type == CRB_RECORD_VALUE) {
+        crb_dispose_record((CRB_Record *)container);
+    }
+    else {
+        crb_dispose_typed_array((CRB_TypedArray *)container);
+    }
+}
+
+// 清除一段, deadline 为 0 时一直清除到结束. 先清除字符串, 再清除容器.
+// 本轮新建的对象插在链表头部或者是黑色的, 都不会被误回收
+static void
+sweep(CRB_Interpreter *interpreter, long deadline)
+{
+    GarbageCollector *gc = &interpreter->gc;
+    CRB_String **pos = gc->sweep_pos;
+    int count = 0;
+
+    while (*pos != NULL) {
+        CRB_String *str = *pos;
+        if (str->marked == gc->black) {
+            gc->sweep_live_bytes += crb_string_bytes(str);
+            pos = &str->gc_next;
+        }
+        else {
+            *pos = str->gc_next;
+            crb_dispose_string(str);
+            gc->stats.freed_count++;
+        }
+        if (out_of_time(&count, deadline)) {
+            gc->sweep_pos = pos;
+            return;
+        }
+    }
+    gc->sweep_pos = pos;
+
+    CRB_Object **container_pos = gc->container_sweep_pos;
+    while (*container_pos != NULL) {
+        CRB_Object *container = *container_pos;
+        if (container->marked == gc->black) {
+            gc->sweep_live_bytes += container_bytes(container);
+            container_pos = &container->gc_next;
+        }
+        else {
+            *container_pos = container->gc_next;
+            dispose_container(container);
+            gc->stats.freed_count++;
+        }
+        if (out_of_time(&count, deadline)) {
+            gc->container_sweep_pos = container_pos;
+            return;
+        }
+    }
+    finish_cycle(gc);
+}
+
+static void
+record_pause(GarbageCollector *gc, long pause)
+{
+    gc->stats.pause_count++;
+    gc->stats.total_pause_ns += pause;
+    gc->stats.last_pause_ns = pause;
+    gc->stats.max_pause_ns = max(gc->stats.max_pause_ns, pause);
+}
+
+void
+crb_gc_collect(CRB_Interpreter *interpreter)
+{
+    GarbageCollector *gc = &interpreter->gc;
+    long start = now_ns();
+
+    if (gc->marking) {
+        mark(interpreter, 0);
+    }
+    if (gc->sweep_pos != NULL) {
+        sweep(interpreter, 0);
+    }
+    start_cycle(interpreter);
+    mark(interpreter, 0);
+    sweep(interpreter, 0);
+
+    record_pause(gc, now_ns() - start);
+}
+
+void
+crb_gc_safe_point(CRB_Interpreter *interpreter)
+{
+    GarbageCollector *gc = &interpreter->gc;
+    if (!gc->enabled
+            || (!gc->marking && gc->sweep_pos == NULL && gc->allocated_bytes < gc->threshold)) {
+        return;
+    }
+
+    long start = now_ns();
+    long deadline = (gc->max_pause_ns > 0) ? start + gc->max_pause_ns : 0;
+
+    if (!gc->marking && gc->sweep_pos == NULL) {
+        start_cycle(interpreter);
+    }
+    if (gc->marking) {
+        mark(interpreter, deadline);
+    }
+    if (!gc->marking) {
+        sweep(interpreter, deadline);
+    }
+
+    record_pause(gc, now_ns() - start);
+}
+
+void
+CRB_set_gc(CRB_Interpreter *interpreter,
+           CRB_Boolean      enabled)
+{
+    GarbageCollector *gc = &interpreter->gc;
+    DBG_assert(interpreter->execute_storage == NULL, "CRB_set_gc must be called before CRB_interpret");
+
+    gc->enabled = enabled;
+    gc->threshold = GC_INITIAL_THRESHOLD;
+}
+
+void
+CRB_set_gc_max_pause(CRB_Interpreter *interpreter,
+                     long             max_pause_ns)
+{
+    interpreter->gc.max_pause_ns = max_pause_ns;
+}
+
+void
+CRB_get_gc_stats(CRB_Interpreter *interpreter,
+                 CRB_GCStats     *stats)
+{
+    *stats = interpreter->gc.stats;
+}
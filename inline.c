@@ -0,0 +1,484 @@
+/**
+ * inline.c
+ * 小函数的内联.
+ *
+ * 函数体只由局部变量的赋值语句和最后一条 return 组成, 并且足够小的 crowbar 函数,
+ * 在调用点展开成内联调用表达式. 形参和局部变量改名为槽位编号,
+ * 求值时实参和局部变量存放在 C 栈上的槽位数组中,
+ * 省去了运行环境和变量的分配, 以及按名字查找函数和变量.
+ * 直接调用自身, 或者经由内联进来的函数调用自身的函数不内联.
+ */
+
+#include "crowbar.h"
+#include "DBG.h"
+#include <string.h>
+
+#define INLINE_MAX_NODE 32  // 内联函数体的表达式结点数的上限
+
+// 构造内联模板时的改名表, 第 i 个名字对应槽位 i
+typedef struct {
+    FunctionDefinition *func;
+    const char         *name[INLINE_MAX_SLOT];
+    int                 slot_count;
+    int                 node_count;
+    CRB_Boolean         failed;
+} Renaming;
+
+static void inline_statement_list(StatementList *list);
+
+static void inline_expression(Expression *expr);
+
+static Expression *clone_expression(Renaming *renaming, Expression *expr);
+
+// 同名的形参以后面的为准, 与 crb_add_local_variable 的查找顺序一致
+static int
+search_slot(Renaming *renaming, const char *name)
+{
+    for (int i = renaming->slot_count - 1; i >= 0; i--) {
+        if (!strcmp(renaming->name[i], name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int
+add_slot(Renaming *renaming, const char *name)
+{
+    if (renaming->slot_count == INLINE_MAX_SLOT) {
+        renaming->failed = CRB_TRUE;
+        return -1;
+    }
+    renaming->name[renaming->slot_count] = name;
+    return renaming->slot_count++;
+}
+
+static ArgumentList *
+clone_argument_list(Renaming *renaming, ArgumentList *list)
+{
+    ArgumentList *head = NULL;
+    ArgumentList **tail = &head;
+
+    for (ArgumentList *pos = list; pos != NULL; pos = pos->next) {
+        *tail = crb_malloc(sizeof(ArgumentList));
+        (*tail)->expression = clone_expression(renaming, pos->expression);
+        tail = &(*tail)->next;
+    }
+    *tail = NULL;
+    return head;
+}
+
+static InlineAssignList *
+clone_assign_list(Renaming *renaming, InlineAssignList *list)
+{
+    InlineAssignList *head = NULL;
+    InlineAssignList **tail = &head;
+
+    for (InlineAssignList *pos = list; pos != NULL; pos = pos->next) {
+        *tail = crb_malloc(sizeof(InlineAssignList));
+        (*tail)->slot = pos->slot;
+        (*tail)->value = clone_expression(renaming, pos->value);
+        tail = &(*tail)->next;
+    }
+    *tail = NULL;
+    return head;
+}
+
+/**
+ * 复制表达式树. renaming 不为 NULL 时构造内联模板:
+ * 标识符改成槽位, 遇到无法内联的结点时设置 renaming->failed
+ */
+static Expression *
+clone_expression(Renaming *renaming, Expression *expr)
+{
+    if (expr == NULL) {
+        return NULL;
+    }
+
+    Expression *copy = crb_malloc(sizeof(Expression));
+    *copy = *expr;
+    if (renaming != NULL) {
+        renaming->node_count++;
+    }
+
+    switch (expr->type) {
+        case IDENTIFIER_EXPRESSION:
+            if (renaming != NULL) {
+                // 函数中没有 global 语句, 不是形参或局部变量的标识符运行时也找不到
+                int slot = search_slot(renaming, expr->u.identifier);
+                if (slot < 0) {
+                    renaming->failed = CRB_TRUE;
+                    break;
+                }
+                copy->type = SLOT_EXPRESSION;
+                copy->u.slot = slot;
+            }
+            break;
+        case ASSIGN_EXPRESSION:
+        case ADD_ASSIGN_EXPRESSION:
+        case SUB_ASSIGN_EXPRESSION:
+        case MUL_ASSIGN_EXPRESSION:
+        case DIV_ASSIGN_EXPRESSION:
+            // 局部变量只能在赋值语句中赋值
+            if (renaming != NULL && expr->u.assign_expression.left->type == IDENTIFIER_EXPRESSION) {
+                renaming->failed = CRB_TRUE;
+                break;
+            }
+            copy->u.assign_expression.left = clone_expression(renaming, expr->u.assign_expression.left);
+            copy->u.assign_expression.operand = clone_expression(renaming, expr->u.assign_expression.operand);
+            break;
+        case INCREMENT_EXPRESSION:
+        case DECREMENT_EXPRESSION:
+            if (renaming != NULL && expr->u.inc_dec->type == IDENTIFIER_EXPRESSION) {
+                renaming->failed = CRB_TRUE;
+                break;
+            }
+            copy->u.inc_dec = clone_expression(renaming, expr->u.inc_dec);
+            break;
+        case ADD_EXPRESSION:
+        case SUB_EXPRESSION:
+        case MUL_EXPRESSION:
+        case DIV_EXPRESSION:
+        case MOD_EXPRESSION:
+        case EQ_EXPRESSION:
+        case NE_EXPRESSION:
+        case GT_EXPRESSION:
+        case GE_EXPRESSION:
+        case LT_EXPRESSION:
+        case LE_EXPRESSION:
+        case LOGICAL_AND_EXPRESSION:
+        case LOGICAL_OR_EXPRESSION:
+            copy->u.binary_expression.left = clone_expression(renaming, expr->u.binary_expression.left);
+            copy->u.binary_expression.right = clone_expression(renaming, expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            copy->u.minus_expression = clone_expression(renaming, expr->u.minus_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            if (renaming != NULL && !strcmp(expr->u.function_call_expression.identifier, renaming->func->name)) {
+                renaming->failed = CRB_TRUE;
+                break;
+            }
+            copy->u.function_call_expression.argument =
+                clone_argument_list(renaming, expr->u.function_call_expression.argument);
+            break;
+        case METHOD_CALL_EXPRESSION:
+            copy->u.method_call_expression.receiver =
+                clone_expression(renaming, expr->u.method_call_expression.receiver);
+            copy->u.method_call_expression.argument =
+                clone_argument_list(renaming, expr->u.method_call_expression.argument);
+            break;
+        case ARRAY_EXPRESSION: {
+            ExpressionList **tail = &copy->u.array_literal;
+            for (ExpressionList *pos = expr->u.array_literal; pos != NULL; pos = pos->next) {
+                *tail = crb_malloc(sizeof(ExpressionList));
+                (*tail)->expression = clone_expression(renaming, pos->expression);
+                tail = &(*tail)->next;
+            }
+            *tail = NULL;
+            break;
+        }
+        case INDEX_EXPRESSION:
+            copy->u.index_expression.array = clone_expression(renaming, expr->u.index_expression.array);
+            copy->u.index_expression.index = clone_expression(renaming, expr->u.index_expression.index);
+            break;
+        case MAP_EXPRESSION: {
+            KeyValueList **tail = &copy->u.map_literal;
+            for (KeyValueList *pos = expr->u.map_literal; pos != NULL; pos = pos->next) {
+                *tail = crb_malloc(sizeof(KeyValueList));
+                (*tail)->key = clone_expression(renaming, pos->key);
+                (*tail)->value = clone_expression(renaming, pos->value);
+                tail = &(*tail)->next;
+            }
+            *tail = NULL;
+            break;
+        }
+        case RECORD_EXPRESSION: {
+            FieldInitList **tail = &copy->u.record_literal.field;
+            for (FieldInitList *pos = expr->u.record_literal.field; pos != NULL; pos = pos->next) {
+                *tail = crb_malloc(sizeof(FieldInitList));
+                (*tail)->name = pos->name;
+                (*tail)->value = clone_expression(renaming, pos->value);
+                tail = &(*tail)->next;
+            }
+            *tail = NULL;
+            break;
+        }
+        case FIELD_EXPRESSION:
+            copy->u.field_expression.record = clone_expression(renaming, expr->u.field_expression.record);
+            break;
+        case INLINE_CALL_EXPRESSION:
+            // 只有实参属于当前函数体, 被内联的函数体中已经是它自己的槽位
+            copy->u.inline_call_expression.argument =
+                clone_argument_list(renaming, expr->u.inline_call_expression.argument);
+            copy->u.inline_call_expression.assign =
+                clone_assign_list(renaming, expr->u.inline_call_expression.assign);
+            copy->u.inline_call_expression.result =
+                clone_expression(renaming, expr->u.inline_call_expression.result);
+            break;
+        default:
+            break;
+    }
+    return copy;
+}
+
+/**
+ * 把函数体改写成内联模板, 不能内联时返回 NULL
+ */
+static Expression *
+create_inline_template(FunctionDefinition *func)
+{
+    Renaming renaming = {
+        .func = func,
+        .slot_count = 0,
+        .node_count = 0,
+        .failed = CRB_FALSE,
+    };
+    for (ParameterList *param = func->u.crowbar_f.parameter; param != NULL; param = param->next) {
+        add_slot(&renaming, param->name);
+    }
+
+    InlineAssignList *assign = NULL;
+    InlineAssignList **tail = &assign;
+    Expression *result = NULL;
+    for (StatementList *pos = func->u.crowbar_f.block->statement_list;
+         pos != NULL && !renaming.failed; pos = pos->next) {
+        Statement *statement = pos->statement;
+        if (statement->type == RETURN_STATEMENT && pos->next == NULL
+                && statement->u.return_s.return_value != NULL) {
+            result = clone_expression(&renaming, statement->u.return_s.return_value);
+            break;
+        }
+
+        if (statement->type != EXPRESSION_STATEMENT) {
+            return NULL;
+        }
+        Expression *expr = statement->u.expression_s;
+        if (expr->type != ASSIGN_EXPRESSION
+                || expr->u.assign_expression.left->type != IDENTIFIER_EXPRESSION) {
+            return NULL;
+        }
+        // 先改写右边, 变量在赋值之后才可见
+        Expression *value = clone_expression(&renaming, expr->u.assign_expression.operand);
+        const char *name = expr->u.assign_expression.left->u.identifier;
+        int slot = search_slot(&renaming, name);
+        if (slot < 0) {
+            slot = add_slot(&renaming, name);
+        }
+        *tail = crb_malloc(sizeof(InlineAssignList));
+        (*tail)->slot = slot;
+        (*tail)->value = value;
+        (*tail)->next = NULL;
+        tail = &(*tail)->next;
+    }
+
+    if (result == NULL || renaming.failed || renaming.node_count > INLINE_MAX_NODE) {
+        return NULL;
+    }
+
+    Expression *template = crb_alloc_expression(INLINE_CALL_EXPRESSION);
+    template->has_side_effect = CRB_TRUE;
+    template->u.inline_call_expression.identifier = func->name;
+    template->u.inline_call_expression.argument = NULL;
+    template->u.inline_call_expression.slot_count = renaming.slot_count;
+    template->u.inline_call_expression.assign = assign;
+    template->u.inline_call_expression.result = result;
+    return template;
+}
+
+/**
+ * 返回函数的内联模板, 不能内联时返回 NULL.
+ * 第一次调用时先展开函数体中的调用, 所以模板中的调用已经尽可能内联了
+ */
+static Expression *
+inline_template(FunctionDefinition *func)
+{
+    if (func == NULL || func->type != CROWBAR_FUNCTION_DEFINITION) {
+        return NULL;
+    }
+    if (func->u.crowbar_f.inline_state == INLINE_NOT_ANALYZED) {
+        func->u.crowbar_f.inline_state = INLINE_ANALYZING;
+        inline_statement_list(func->u.crowbar_f.block->statement_list);
+        func->u.crowbar_f.inline_body = create_inline_template(func);
+        func->u.crowbar_f.inline_state = INLINE_ANALYZED;
+    }
+    return func->u.crowbar_f.inline_body;
+}
+
+static int
+parameter_count(FunctionDefinition *func)
+{
+    int count = 0;
+    for (ParameterList *param = func->u.crowbar_f.parameter; param != NULL; param = param->next) {
+        count++;
+    }
+    return count;
+}
+
+static void
+inline_argument_list(ArgumentList *list)
+{
+    for (ArgumentList *pos = list; pos != NULL; pos = pos->next) {
+        inline_expression(pos->expression);
+    }
+}
+
+// 实参个数与形参不同的调用保持原样, 由运行时处理
+static void
+inline_function_call(Expression *expr)
+{
+    ArgumentList *argument = expr->u.function_call_expression.argument;
+    FunctionDefinition *func = crb_search_function(expr->u.function_call_expression.identifier);
+    Expression *template = inline_template(func);
+
+    if (template == NULL) {
+        return;
+    }
+    int argument_count = 0;
+    for (ArgumentList *pos = argument; pos != NULL; pos = pos->next) {
+        argument_count++;
+    }
+    if (argument_count != parameter_count(func)) {
+        return;
+    }
+
+    // 每个调用点有自己的一份函数体, 其中的内联缓存互不干扰
+    Expression *body = clone_expression(NULL, template);
+    expr->type = INLINE_CALL_EXPRESSION;
+    expr->u.inline_call_expression = body->u.inline_call_expression;
+    expr->u.inline_call_expression.argument = argument;
+}
+
+static void
+inline_expression(Expression *expr)
+{
+    if (expr == NULL) {
+        return;
+    }
+
+    switch (expr->type) {
+        case ASSIGN_EXPRESSION:
+        case ADD_ASSIGN_EXPRESSION:
+        case SUB_ASSIGN_EXPRESSION:
+        case MUL_ASSIGN_EXPRESSION:
+        case DIV_ASSIGN_EXPRESSION:
+            inline_expression(expr->u.assign_expression.left);
+            inline_expression(expr->u.assign_expression.operand);
+            break;
+        case INCREMENT_EXPRESSION:
+        case DECREMENT_EXPRESSION:
+            inline_expression(expr->u.inc_dec);
+            break;
+        case ADD_EXPRESSION:
+        case SUB_EXPRESSION:
+        case MUL_EXPRESSION:
+        case DIV_EXPRESSION:
+        case MOD_EXPRESSION:
+        case EQ_EXPRESSION:
+        case NE_EXPRESSION:
+        case GT_EXPRESSION:
+        case GE_EXPRESSION:
+        case LT_EXPRESSION:
+        case LE_EXPRESSION:
+        case LOGICAL_AND_EXPRESSION:
+        case LOGICAL_OR_EXPRESSION:
+            inline_expression(expr->u.binary_expression.left);
+            inline_expression(expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            inline_expression(expr->u.minus_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            inline_argument_list(expr->u.function_call_expression.argument);
+            inline_function_call(expr);
+            break;
+        case METHOD_CALL_EXPRESSION:
+            inline_expression(expr->u.method_call_expression.receiver);
+            inline_argument_list(expr->u.method_call_expression.argument);
+            break;
+        case ARRAY_EXPRESSION:
+            for (ExpressionList *pos = expr->u.array_literal; pos != NULL; pos = pos->next) {
+                inline_expression(pos->expression);
+            }
+            break;
+        case INDEX_EXPRESSION:
+            inline_expression(expr->u.index_expression.array);
+            inline_expression(expr->u.index_expression.index);
+            break;
+        case MAP_EXPRESSION:
+            for (KeyValueList *pos = expr->u.map_literal; pos != NULL; pos = pos->next) {
+                inline_expression(pos->key);
+                inline_expression(pos->value);
+            }
+            break;
+        case RECORD_EXPRESSION:
+            for (FieldInitList *pos = expr->u.record_literal.field; pos != NULL; pos = pos->next) {
+                inline_expression(pos->value);
+            }
+            break;
+        case FIELD_EXPRESSION:
+            inline_expression(expr->u.field_expression.record);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+inline_block(Block *block)
+{
+    if (block != NULL) {
+        inline_statement_list(block->statement_list);
+    }
+}
+
+static void
+inline_statement(Statement *statement)
+{
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            inline_expression(statement->u.expression_s);
+            break;
+        case IF_STATEMENT:
+            inline_expression(statement->u.if_s.condition);
+            inline_block(statement->u.if_s.then_block);
+            for (Elsif *pos = statement->u.if_s.elsif_list; pos != NULL; pos = pos->next) {
+                inline_expression(pos->condition);
+                inline_block(pos->block);
+            }
+            inline_block(statement->u.if_s.else_block);
+            break;
+        case WHILE_STATEMENT:
+            inline_expression(statement->u.while_s.condition);
+            inline_block(statement->u.while_s.block);
+            break;
+        case FOR_STATEMENT:
+            inline_expression(statement->u.for_s.init);
+            inline_expression(statement->u.for_s.condition);
+            inline_expression(statement->u.for_s.post);
+            inline_block(statement->u.for_s.block);
+            break;
+        case RETURN_STATEMENT:
+            inline_expression(statement->u.return_s.return_value);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+inline_statement_list(StatementList *list)
+{
+    for (StatementList *pos = list; pos != NULL; pos = pos->next) {
+        inline_statement(pos->statement);
+    }
+}
+
+void
+crb_inline_functions(CRB_Interpreter *interpreter)
+{
+    for (FunctionDefinition *func = interpreter->function_list; func != NULL; func = func->next) {
+        inline_template(func);
+    }
+    inline_statement_list(interpreter->statement_list);
+}
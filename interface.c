@@ -1,5 +1,7 @@
 #include "crowbar.h"
+#include "DBG.h"
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * 添加默认内置函数
@@ -9,6 +11,34 @@ static void
 add_default_native_functions(CRB_Interpreter *interpreter)
 {
     CRB_add_native_function(interpreter, "print", crb_native_print);
+    CRB_add_native_function(interpreter, "intern", crb_native_intern);
+    CRB_add_native_function(interpreter, "substr", crb_native_substr);
+    CRB_add_native_function(interpreter, "trim", crb_native_trim);
+    CRB_add_native_function(interpreter, "split", crb_native_split);
+    CRB_add_native_function(interpreter, "find", crb_native_find);
+    CRB_add_native_function(interpreter, "count", crb_native_count);
+    CRB_add_native_function(interpreter, "replace", crb_native_replace);
+    CRB_add_native_function(interpreter, "starts_with", crb_native_starts_with);
+    CRB_add_native_function(interpreter, "parse_int", crb_native_parse_int);
+    CRB_add_native_function(interpreter, "parse_double", crb_native_parse_double);
+    CRB_add_native_function(interpreter, "mem_stats", crb_native_mem_stats);
+    CRB_add_native_function(interpreter, "mem_profile", crb_native_mem_profile);
+    CRB_add_native_function(interpreter, "gc_stats", crb_native_gc_stats);
+    CRB_add_native_function(interpreter, "add", crb_native_add);
+    CRB_add_native_function(interpreter, "size", crb_native_size);
+    CRB_add_native_function(interpreter, "get", crb_native_get);
+    CRB_add_native_function(interpreter, "put", crb_native_put);
+    CRB_add_native_function(interpreter, "remove", crb_native_remove);
+    CRB_add_native_function(interpreter, "keys", crb_native_keys);
+    CRB_add_native_function(interpreter, "fopen", crb_native_fopen);
+    CRB_add_native_function(interpreter, "int_array", crb_native_int_array);
+    CRB_add_native_function(interpreter, "double_array", crb_native_double_array);
+    CRB_add_native_function(interpreter, "sum", crb_native_sum);
+    CRB_add_native_function(interpreter, "min", crb_native_min);
+    CRB_add_native_function(interpreter, "max", crb_native_max);
+    CRB_add_native_function(interpreter, "dot", crb_native_dot);
+    CRB_add_native_function(interpreter, "scale", crb_native_scale);
+    CRB_add_native_function(interpreter, "fill", crb_native_fill);
 }
 
 CRB_Interpreter *
@@ -19,10 +49,26 @@ CRB_create_interpreter()
             storage, sizeof(CRB_Interpreter));
     interpreter->interpreter_storage = storage;
     interpreter->execute_storage = NULL;
+    interpreter->scratch_storage = NULL;
     interpreter->variable = NULL;
     interpreter->function_list = NULL;
     interpreter->statement_list = NULL;
     interpreter->current_line_number = 1;
+    interpreter->string_free_list = NULL;
+    interpreter->intern_table.bucket = NULL;
+    interpreter->intern_table.bucket_num = 0;
+    interpreter->intern_table.count = 0;
+    interpreter->intern_on_create = CRB_FALSE;
+    interpreter->mapped_storage = CRB_FALSE;
+    memset(&interpreter->gc, 0, sizeof(interpreter->gc));
+    interpreter->shape_list = NULL;
+    interpreter->constant_list = NULL;
+    interpreter->inline_frame = NULL;
+    interpreter->release_list = NULL;
+    interpreter->releasing = CRB_FALSE;
+
+    // 分配剖析的样本按当前行号归类: 编译时是词法分析的行号, 执行时是正在执行的语句的行号
+    MEM_set_profile_context(&interpreter->current_line_number);
 
     crb_set_current_interpreter(interpreter);
     return interpreter;
@@ -35,19 +81,29 @@ CRB_compile(CRB_Interpreter *interpreter, FILE *fp)
     extern FILE *yyin;
 
     crb_set_current_interpreter(interpreter);
+    if (interpreter->mapped_storage) {
+        // 解释器本身和之前登记的内置函数留在原来的存储器中, 它与解释器同生命周期
+        interpreter->interpreter_storage = MEM_open_mapped_storage(0);
+    }
     yyin = fp;
     if (yyparse()) {
         exit(1);
     }
     crb_reset_string_literal();
+    // 内联时要知道函数名最终解析到哪个函数, 内置函数在编译后立即登记.
+    // 与脚本中的同名函数冲突时脚本中的函数优先, 见 crb_search_function
+    add_default_native_functions(interpreter);
+    crb_fold_constants(interpreter);
+    crb_inline_functions(interpreter);
+    crb_analyze_escape(interpreter);
 }
 
 void
 CRB_interpret(CRB_Interpreter *interpreter)
 {
     interpreter->execute_storage = MEM_open_storage(0);
+    interpreter->scratch_storage = MEM_open_storage(0);
     crb_add_std_fp(interpreter);
-    add_default_native_functions(interpreter);
     crb_execute_statement_list(interpreter, NULL, interpreter->statement_list);
 }
 
@@ -66,3 +122,18 @@ CRB_add_native_function(CRB_Interpreter        *interpreter,
     fd->next = interpreter->function_list;
     interpreter->function_list = fd;
 }
+
+void
+CRB_set_mapped_storage(CRB_Interpreter *interpreter,
+                       CRB_Boolean      enabled)
+{
+    DBG_assert(interpreter->statement_list == NULL, "CRB_set_mapped_storage must be called before CRB_compile");
+    interpreter->mapped_storage = enabled;
+}
+
+void
+CRB_set_string_interning(CRB_Interpreter *interpreter,
+                         CRB_Boolean      enabled)
+{
+    interpreter->intern_on_create = enabled;
+}
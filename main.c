@@ -1,5 +1,6 @@
 #include "MEM.h"
 #include "CRB.h"
+#include "CRB_dev.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -7,9 +8,34 @@
 
 int main(int argc, char *argv[])
 {
+    // CRB_MEM_PROFILE=<bytes>: sample one allocation per <bytes> bytes and report at exit
+    const char *profile = getenv("CRB_MEM_PROFILE");
+    if (profile != NULL) {
+        MEM_enable_profile(strtoul(profile, NULL, 10));
+    }
+
     CRB_Interpreter *interpreter = CRB_create_interpreter();
+    // CRB_MAPPED_STORAGE=1: keep the syntax tree in mmap-backed storage, using huge pages when available
+    const char *mapped = getenv("CRB_MAPPED_STORAGE");
+    if (mapped != NULL && atoi(mapped) != 0) {
+        CRB_set_mapped_storage(interpreter, CRB_TRUE);
+    }
+    // CRB_GC=1: manage runtime strings with the mark-sweep collector instead of reference counts
+    const char *gc = getenv("CRB_GC");
+    if (gc != NULL && atoi(gc) != 0) {
+        CRB_set_gc(interpreter, CRB_TRUE);
+    }
+    // CRB_GC_MAX_PAUSE_US=<usec>: spread each collection over safe points, at most <usec> each
+    const char *max_pause = getenv("CRB_GC_MAX_PAUSE_US");
+    if (max_pause != NULL) {
+        CRB_set_gc_max_pause(interpreter, atol(max_pause) * 1000);
+    }
     CRB_compile(interpreter, fopen(argv[1], "r"));
     CRB_interpret(interpreter);
+
+    if (profile != NULL) {
+        MEM_dump_profile(stderr);
+    }
     return 0;
 }
 
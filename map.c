@@ -0,0 +1,258 @@
+/**
+ * map.c
+ * 以 int 或字符串为键的映射, 开放寻址的 Robin Hood 哈希表.
+ *
+ * 所有槽连续存放, 探测只是顺序访问相邻的槽.
+ * 插入时如果手中的元素比槽中的元素离理想位置更远, 就交换两者继续插入,
+ * 这样探测链长度的方差很小, 装载因子较高时查找也很快.
+ * 删除时把后面的元素依次前移 (backward shift), 不需要墓碑.
+ */
+
+#include "crowbar.h"
+#include "DBG.h"
+#include <string.h>
+
+// 第一次插入时的槽数
+#define MAP_INIT_CAPACITY (8)
+
+// 装载因子上限为 MAP_LOAD_NUMERATOR / MAP_LOAD_DENOMINATOR
+#define MAP_LOAD_NUMERATOR   (7)
+#define MAP_LOAD_DENOMINATOR (8)
+
+static unsigned int
+hash_key(CRB_Value *key)
+{
+    unsigned int hash = 0;
+
+    if (key->type == CRB_INT_VALUE) {
+        // 乘法散列把低位的差异扩散到高位, 再折叠回低位, 因为槽号取的是低位
+        hash = (unsigned int)key->u.int_value * 0x9E3779B1u;
+        hash ^= hash >> 16;
+    }
+    else if (key->type == CRB_STRING_VALUE) {
+        hash = crb_string_hash(key->u.string_value);
+    }
+    else {
+        crb_runtime_error(crb_get_current_interpreter()->current_line_number,
+                          "map key must be an int or a string");
+    }
+    return hash;
+}
+
+static CRB_Boolean
+key_equals(CRB_Value *left, CRB_Value *right)
+{
+    if (left->type != right->type) {
+        return CRB_FALSE;
+    }
+    if (left->type == CRB_INT_VALUE) {
+        return (left->u.int_value == right->u.int_value) ? CRB_TRUE : CRB_FALSE;
+    }
+
+    CRB_String *left_str = left->u.string_value;
+    CRB_String *right_str = right->u.string_value;
+    if (left_str == right_str) {
+        return CRB_TRUE;
+    }
+    // 两边都已驻留时, 内容相等当且仅当指针相等
+    if (left_str->is_interned && right_str->is_interned) {
+        return CRB_FALSE;
+    }
+    return (left_str->length == right_str->length
+            && !memcmp(left_str->string, right_str->string, left_str->length)) ?
+           CRB_TRUE : CRB_FALSE;
+}
+
+static MapEntry *
+find_entry(CRB_Map *map, CRB_Value *key, unsigned int hash)
+{
+    if (map->capacity == 0) {
+        return NULL;
+    }
+
+    unsigned int mask = map->capacity - 1;
+    unsigned int i = hash & mask;
+    for (int distance = 1; ; distance++) {
+        MapEntry *entry = &map->entry[i];
+        // 空槽, 或者槽中的元素比要找的键离理想位置更近: 键不存在
+        if (entry->distance < distance) {
+            return NULL;
+        }
+        if (entry->hash == hash && key_equals(&entry->key, key)) {
+            return entry;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+// 插入一个确定不存在的元素, 不检查容量.
+// 写入槽中的元素 (包括被挤到后面的元素) 都经过写屏障
+static void
+insert_entry(CRB_Interpreter *interpreter, CRB_Map *map, MapEntry entry)
+{
+    unsigned int mask = map->capacity - 1;
+    unsigned int i = entry.hash & mask;
+
+    entry.distance = 1;
+    for (;;) {
+        MapEntry *slot = &map->entry[i];
+        if (slot->distance == 0) {
+            *slot = entry;
+            crb_gc_write_barrier(interpreter, &slot->key);
+            crb_gc_write_barrier(interpreter, &slot->value);
+            return;
+        }
+        if (slot->distance < entry.distance) {
+            MapEntry temp = *slot;
+            *slot = entry;
+            crb_gc_write_barrier(interpreter, &slot->key);
+            crb_gc_write_barrier(interpreter, &slot->value);
+            entry = temp;
+        }
+        entry.distance++;
+        i = (i + 1) & mask;
+    }
+}
+
+static void
+grow_map(CRB_Interpreter *interpreter, CRB_Map *map)
+{
+    int old_capacity = map->capacity;
+    MapEntry *old_entry = map->entry;
+
+    map->capacity = (old_capacity == 0) ? MAP_INIT_CAPACITY : old_capacity * 2;
+    map->entry = MEM_malloc(sizeof(MapEntry) * map->capacity);
+    memset(map->entry, 0, sizeof(MapEntry) * map->capacity);
+    if (interpreter->gc.enabled) {
+        crb_gc_add_bytes(interpreter, sizeof(MapEntry) * (map->capacity - old_capacity));
+    }
+
+    for (int i = 0; i < old_capacity; i++) {
+        if (old_entry[i].distance != 0) {
+            insert_entry(interpreter, map, old_entry[i]);
+        }
+    }
+    MEM_free(old_entry);
+}
+
+CRB_Map *
+crb_create_map(CRB_Interpreter *interpreter)
+{
+    CRB_Map *map = MEM_malloc(sizeof(CRB_Map));
+    map->header.type = CRB_MAP_VALUE;
+    map->header.ref_count = 1;
+    map->header.marked = CRB_FALSE;  // 由回收器登记时设置
+    map->header.gc_next = NULL;
+    map->count = 0;
+    map->capacity = 0;
+    map->entry = NULL;
+    if (interpreter->gc.enabled) {
+        crb_gc_register_container(interpreter, &map->header, crb_map_bytes(map));
+    }
+    return map;
+}
+
+CRB_Value *
+crb_map_get(CRB_Map *map, CRB_Value *key)
+{
+    MapEntry *entry = find_entry(map, key, hash_key(key));
+    return (entry != NULL) ? &entry->value : NULL;
+}
+
+void
+crb_map_put(CRB_Interpreter *interpreter, CRB_Map *map, CRB_Value *key, CRB_Value *value)
+{
+    unsigned int hash = hash_key(key);
+    MapEntry *entry = find_entry(map, key, hash);
+
+    crb_refer_value(value);
+    if (entry != NULL) {
+        crb_release_value(&entry->value);
+        entry->value = *value;
+        crb_gc_write_barrier(interpreter, value);
+        return;
+    }
+
+    if ((map->count + 1) * MAP_LOAD_DENOMINATOR > map->capacity * MAP_LOAD_NUMERATOR) {
+        grow_map(interpreter, map);
+    }
+    MapEntry new_entry = {
+        .key = *key,
+        .value = *value,
+        .hash = hash,
+    };
+    // 键可能长期存放在映射中, 视图需要实体化, 不应一直钉住父字符串
+    if (key->type == CRB_STRING_VALUE) {
+        crb_string_to_c(key->u.string_value);
+    }
+    crb_refer_value(key);
+    insert_entry(interpreter, map, new_entry);
+    map->count++;
+}
+
+CRB_Boolean
+crb_map_remove(CRB_Map *map, CRB_Value *key)
+{
+    MapEntry *entry = find_entry(map, key, hash_key(key));
+    if (entry == NULL) {
+        return CRB_FALSE;
+    }
+
+    crb_release_value(&entry->key);
+    crb_release_value(&entry->value);
+
+    // 后面不在理想槽上的元素依次前移一个槽.
+    // 前移的元素可能移到回收器已经扫描过的槽, 需要经过写屏障
+    CRB_Interpreter *interpreter = crb_get_current_interpreter();
+    unsigned int mask = map->capacity - 1;
+    unsigned int i = entry - map->entry;
+    unsigned int next = (i + 1) & mask;
+    while (map->entry[next].distance > 1) {
+        map->entry[i] = map->entry[next];
+        map->entry[i].distance--;
+        crb_gc_write_barrier(interpreter, &map->entry[i].key);
+        crb_gc_write_barrier(interpreter, &map->entry[i].value);
+        i = next;
+        next = (next + 1) & mask;
+    }
+    map->entry[i].distance = 0;
+    map->count--;
+
+    return CRB_TRUE;
+}
+
+void
+crb_refer_map(CRB_Map *map)
+{
+    if (!crb_get_current_interpreter()->gc.enabled) {
+        map->header.ref_count++;
+    }
+}
+
+void
+crb_dispose_map(CRB_Map *map)
+{
+    MEM_free(map->entry);
+    MEM_free(map);
+}
+
+void
+crb_release_map(CRB_Map *map)
+{
+    if (crb_get_current_interpreter()->gc.enabled) {
+        return;
+    }
+
+    map->header.ref_count--;
+    DBG_assert(map->header.ref_count >= 0, "ref count < 0");
+
+    if (map->header.ref_count == 0) {
+        crb_release_container(&map->header);
+    }
+}
+
+size_t
+crb_map_bytes(CRB_Map *map)
+{
+    return sizeof(CRB_Map) + sizeof(MapEntry) * map->capacity;
+}
@@ -13,8 +13,8 @@ union Header_tag {
         int size;  // The allocated size
         const char *filename;
         int line;
-        Header *prev;
-        Header *next;
+        int index;  // The slot in the block registry
+        int site;   // The index of the allocation site in the block registry
         uint8_t mark[MARK_SIZE];  // Check
     };
 };
@@ -23,6 +23,37 @@ union Header_tag {
 #define MARK 0xCD
 
 
+// Every raw block starts with a prefix holding the requested size,
+// so that free and realloc can find the size class without a lookup.
+typedef union {
+    long   l_dummy;
+    double d_dummy;
+    void  *p_dummy;
+    size_t size;
+} Prefix;
+
+#define PREFIX_SIZE (sizeof(Prefix))
+
+union FreeBlock_tag {
+    Prefix     prefix;
+    struct {
+        Prefix     prefix;
+        FreeBlock *next;
+    } s;
+};
+
+// The size of memory carved into blocks of one size class at a time.
+#define SLAB_SIZE (64 * 1024)
+
+#define SMALL_BLOCK_LIMIT (MEM_SIZE_CLASS_STEP * MEM_SIZE_CLASS_NUM)
+
+// DEBUG builds check the marks of this many blocks on every allocation.
+#define DEFAULT_CHECK_RATE (4)
+
+#define SITE_SLOT_INIT_NUM (256)
+#define BLOCK_INIT_CAPACITY (1024)
+
+
 static void
 default_error_handler(FILE *error_fp, const char *filename, int line, const char *msg)
 {
@@ -46,9 +77,10 @@ error_handler(MEM_Controller controller, const char *filename, int line, const c
 
 
 static struct MEM_Controller_tag st_default_controller = {
-    NULL,
-    default_error_handler,
-    MEM_FAIL_AND_EXIT
+    .error_file = NULL,
+    .error_handler = default_error_handler,
+    .fail_mode = MEM_FAIL_AND_EXIT,
+    .registry.check_rate = DEFAULT_CHECK_RATE,
 };
 MEM_Controller mem_default_controller = &st_default_controller;
 
@@ -61,53 +93,284 @@ MEM_create_controller()
     MEM_Controller p;
     p = MEM_malloc_func(&st_default_controller, __FILE__, __LINE__, sizeof(*p));
     *p = st_default_controller;
+    memset(&p->registry, 0, sizeof(p->registry));
+    p->registry.check_rate = DEFAULT_CHECK_RATE;
+    memset(p->free_list, 0, sizeof(p->free_list));
+    memset(&p->stats, 0, sizeof(p->stats));
+    p->profile = NULL;
+    p->context_line = NULL;
     return p;
 }
 
 
-#ifdef DEBUG
-// chain_block: add a new block node in the head.
-static void
-chain_block(MEM_Controller controller, Header *new_header)
+// size_class: the index of the size class serving `size' bytes,
+//   or -1 if the request is too large and goes to malloc.
+static inline int
+size_class(size_t size)
 {
-    if (controller->block_header != NULL) {
-        controller->block_header->prev = new_header;
+    if (size == 0 || size > SMALL_BLOCK_LIMIT) {
+        return -1;
+    }
+    return (size - 1) / MEM_SIZE_CLASS_STEP;
+}
+
+
+// refill_free_list: carve a new slab into blocks of one size class.
+//   Slabs are never returned to the system.
+static int
+refill_free_list(MEM_Controller controller, int class)
+{
+    size_t block_size = PREFIX_SIZE + (class + 1) * MEM_SIZE_CLASS_STEP;
+    int block_num = SLAB_SIZE / block_size;
+    uint8_t *slab = malloc(block_size * block_num);
+
+    if (slab == NULL) {
+        return 0;
+    }
+    for (int i = block_num - 1; i >= 0; i--) {
+        FreeBlock *block = (FreeBlock *)(slab + i * block_size);
+        block->s.next = controller->free_list[class];
+        controller->free_list[class] = block;
+    }
+    return 1;
+}
+
+
+static inline void
+add_live_bytes(MEM_Controller controller, size_t size)
+{
+    controller->stats.live_bytes += size;
+    if (controller->stats.live_bytes > controller->stats.peak_bytes) {
+        controller->stats.peak_bytes = controller->stats.live_bytes;
+    }
+}
+
+
+// raw_alloc: allocate `size' bytes, from the size class free lists
+//   when possible. Returns NULL on failure.
+static void *
+raw_alloc(MEM_Controller controller, size_t size)
+{
+    Prefix *prefix;
+    int class = size_class(size);
+
+    if (class >= 0) {
+        if (controller->free_list[class] == NULL
+                && !refill_free_list(controller, class)) {
+            return NULL;
+        }
+        FreeBlock *block = controller->free_list[class];
+        controller->free_list[class] = block->s.next;
+        prefix = &block->prefix;
     }
-    new_header->prev = NULL;
-    new_header->next = controller->block_header;
-    controller->block_header = new_header;
+    else {
+        prefix = malloc(PREFIX_SIZE + size);
+        if (prefix == NULL) {
+            return NULL;
+        }
+    }
+
+    prefix->size = size;
+    add_live_bytes(controller, size);
+    controller->stats.alloc_count++;
+    return (uint8_t *)prefix + PREFIX_SIZE;
 }
 
 
-// rechain_block: used by realloc
 static void
-rechain_block(MEM_Controller controller, Header *header)
+raw_free(MEM_Controller controller, void *ptr)
 {
-    if (header->prev != NULL) {
-        header->prev->next = header;
+    Prefix *prefix = (Prefix *)((uint8_t *)ptr - PREFIX_SIZE);
+    int class = size_class(prefix->size);
+
+    controller->stats.live_bytes -= prefix->size;
+    controller->stats.free_count++;
+
+    if (class >= 0) {
+        FreeBlock *block = (FreeBlock *)prefix;
+        block->s.next = controller->free_list[class];
+        controller->free_list[class] = block;
     }
     else {
-        controller->block_header = header;
+        free(prefix);
+    }
+}
+
+
+// raw_realloc: blocks staying in the same size class are reused in place,
+//   large blocks are handed to realloc, the rest are copied.
+static void *
+raw_realloc(MEM_Controller controller, void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return raw_alloc(controller, size);
     }
-    if (header->next != NULL) {
-        header->next->prev = header;
+
+    Prefix *prefix = (Prefix *)((uint8_t *)ptr - PREFIX_SIZE);
+    size_t old_size = prefix->size;
+    int old_class = size_class(old_size);
+    int new_class = size_class(size);
+
+    if (old_class >= 0 && old_class == new_class) {
+        prefix->size = size;
+        controller->stats.live_bytes -= old_size;
+        add_live_bytes(controller, size);
+        return ptr;
+    }
+    if (old_class < 0 && new_class < 0 && size > 0) {
+        prefix = realloc(prefix, PREFIX_SIZE + size);
+        if (prefix == NULL) {
+            return NULL;
+        }
+        prefix->size = size;
+        controller->stats.live_bytes -= old_size;
+        add_live_bytes(controller, size);
+        return (uint8_t *)prefix + PREFIX_SIZE;
+    }
+
+    void *new_ptr = raw_alloc(controller, size);
+    if (new_ptr == NULL) {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+    raw_free(controller, ptr);
+    // Moving a block is neither a new allocation nor a free for the caller.
+    controller->stats.alloc_count--;
+    controller->stats.free_count--;
+    return new_ptr;
+}
+
+
+#ifdef DEBUG
+// The registry is bookkeeping of the debugger itself,
+// so it uses malloc directly and gives up when malloc fails.
+static void *
+grow_array(void *array, int *capacity, size_t elem_size, int init_capacity)
+{
+    int new_capacity = (*capacity == 0) ? init_capacity : *capacity * 2;
+    void *new_array = realloc(array, elem_size * new_capacity);
+    if (new_array == NULL) {
+        fprintf(stderr, "MEM: no memory for the block registry\n");
+        abort();
+    }
+    *capacity = new_capacity;
+    return new_array;
+}
+
+
+static inline unsigned int
+hash_site(const char *filename, int line)
+{
+    uintptr_t h = (uintptr_t)filename * 31 + (unsigned int)line;
+    return (unsigned int)(h ^ (h >> 16));
+}
+
+
+// find_site_slot: the slot holding the site, or the empty slot where it belongs.
+//   Filenames come from __FILE__, so comparing the pointers is enough.
+static int *
+find_site_slot(BlockRegistry *registry, const char *filename, int line)
+{
+    unsigned int mask = registry->site_slot_num - 1;
+    unsigned int i = hash_site(filename, line) & mask;
+    for (;;) {
+        int site = registry->site_slot[i];
+        if (site < 0
+                || (registry->site[site].filename == filename && registry->site[site].line == line)) {
+            return &registry->site_slot[i];
+        }
+        i = (i + 1) & mask;
     }
 }
 
 
-// unchain_block: delete a block
 static void
-unchain_block(MEM_Controller controller, Header *header)
+grow_site_slot(BlockRegistry *registry)
 {
-    if (header->prev != NULL) {
-        header->prev->next = header->next;
+    int new_num = (registry->site_slot_num == 0) ? SITE_SLOT_INIT_NUM : registry->site_slot_num * 2;
+    int *new_slot = malloc(sizeof(int) * new_num);
+    if (new_slot == NULL) {
+        fprintf(stderr, "MEM: no memory for the block registry\n");
+        abort();
     }
-    else {
-        controller->block_header = header->next;
+    memset(new_slot, 0xFF, sizeof(int) * new_num);  // All -1
+
+    free(registry->site_slot);
+    registry->site_slot = new_slot;
+    registry->site_slot_num = new_num;
+    for (int i = 0; i < registry->site_num; i++) {
+        *find_site_slot(registry, registry->site[i].filename, registry->site[i].line) = i;
+    }
+}
+
+
+// lookup_site: the index of the site, added on first use.
+static int
+lookup_site(BlockRegistry *registry, const char *filename, int line)
+{
+    if (registry->site_num * 2 >= registry->site_slot_num) {
+        grow_site_slot(registry);
     }
-    if (header->next != NULL) {
-        header->next->prev = header->prev;
+    int *slot = find_site_slot(registry, filename, line);
+    if (*slot < 0) {
+        if (registry->site_num == registry->site_capacity) {
+            registry->site = grow_array(registry->site, &registry->site_capacity,
+                                        sizeof(BlockSite), SITE_SLOT_INIT_NUM / 2);
+        }
+        BlockSite *site = &registry->site[registry->site_num];
+        site->filename = filename;
+        site->line = line;
+        site->block_num = 0;
+        site->bytes = 0;
+        *slot = registry->site_num++;
     }
+    return *slot;
+}
+
+
+// register_block: add a new block and charge it to its site.
+static void
+register_block(MEM_Controller controller, Header *header)
+{
+    BlockRegistry *registry = &controller->registry;
+
+    if (registry->block_num == registry->block_capacity) {
+        registry->block = grow_array(registry->block, &registry->block_capacity,
+                                     sizeof(Header *), BLOCK_INIT_CAPACITY);
+    }
+    header->index = registry->block_num;
+    registry->block[registry->block_num++] = header;
+
+    header->site = lookup_site(registry, header->filename, header->line);
+    registry->site[header->site].block_num++;
+    registry->site[header->site].bytes += header->size;
+}
+
+
+// rebind_block: used by realloc, the block may have moved or resized.
+static void
+rebind_block(MEM_Controller controller, Header *header, int old_size)
+{
+    BlockRegistry *registry = &controller->registry;
+
+    registry->block[header->index] = header;
+    registry->site[header->site].bytes -= old_size;
+    registry->site[header->site].bytes += header->size;
+}
+
+
+// unregister_block: delete a block, the last block takes over its slot.
+static void
+unregister_block(MEM_Controller controller, Header *header)
+{
+    BlockRegistry *registry = &controller->registry;
+
+    Header *last = registry->block[--registry->block_num];
+    registry->block[header->index] = last;
+    last->index = header->index;
+
+    registry->site[header->site].block_num--;
+    registry->site[header->site].bytes -= header->size;
 }
 
 
@@ -156,6 +419,25 @@ check_mark(Header *header)
     unsigned char *tail = ((unsigned char *)header) + header->size + sizeof(Header);
     check_mark_sub(tail, MARK_SIZE);
 }
+
+
+// scan_blocks: check `count' blocks, going on from where the last scan stopped.
+//   Calling it on every allocation spreads a full check over the run.
+static void
+scan_blocks(MEM_Controller controller, int count)
+{
+    BlockRegistry *registry = &controller->registry;
+
+    if (count > registry->block_num) {
+        count = registry->block_num;
+    }
+    for (int i = 0; i < count; i++) {
+        if (registry->check_cursor >= registry->block_num) {
+            registry->check_cursor = 0;
+        }
+        check_mark(registry->block[registry->check_cursor++]);
+    }
+}
 #endif // DEBUG
 
 
@@ -169,17 +451,21 @@ MEM_malloc_func(MEM_Controller controller, const char *filename, int line, size_
     size_t alloc_size = size;
 #endif
 
-    void *ptr = malloc(alloc_size);
+    void *ptr = raw_alloc(controller, alloc_size);
 
     if (ptr == NULL) {
         error_handler(controller, filename, line, "malloc");
     }
+    else if (controller->profile != NULL) {
+        mem_sample_allocation(controller, filename, line, size);
+    }
 
 #ifdef DEBUG
     memset(ptr, 0xCC, alloc_size);  // Avoid uninitialization by caller.
     set_header(ptr, size, filename, line);
     set_tail(ptr, alloc_size);
-    chain_block(controller, ptr);
+    register_block(controller, ptr);
+    scan_blocks(controller, controller->registry.check_rate);
     ptr = (uint8_t *)ptr + sizeof(Header);  // Jump the header.
 #endif
 
@@ -204,7 +490,6 @@ MEM_realloc_func(MEM_Controller controller, const char *filename, int line, void
         check_mark((Header *)real_ptr);
         old_header = *(Header *)real_ptr;  // Save the header onto stack.
         old_size = old_header.size;
-        unchain_block(controller, (Header *)real_ptr);
     }
     else {
         real_ptr = NULL;
@@ -215,7 +500,7 @@ MEM_realloc_func(MEM_Controller controller, const char *filename, int line, void
     real_ptr = ptr;
 #endif
 
-    new_ptr = realloc(real_ptr, alloc_size);
+    new_ptr = raw_realloc(controller, real_ptr, alloc_size);
     if (new_ptr == NULL) {
         if (real_ptr == NULL) {
             error_handler(controller, filename, line, "realloc(malloc)");
@@ -224,6 +509,9 @@ MEM_realloc_func(MEM_Controller controller, const char *filename, int line, void
             error_handler(controller, filename, line, "realloc");
         }
     }
+    else if (controller->profile != NULL) {
+        mem_sample_allocation(controller, filename, line, size);
+    }
 
 #ifdef DEBUG
     if (real_ptr != NULL) {
@@ -232,15 +520,8 @@ MEM_realloc_func(MEM_Controller controller, const char *filename, int line, void
         // Update size field.
         ((Header *)new_ptr)->size = size;
 
-        // Relink to where it used to be linked.
-        // When debugging, reallocated memory block may have a new memory area,
-        // but the data is reserved, which means that using this reallocated
-        // memory header, we can find its preccedence and its successor,
-        // but its preccedence and its successor may contain a wrong pointer
-        // which points to the old memory block. So a re-chain process is needed.
-        // TODO check whether we need to unchain the node and save the content
-        // of the header onto stack?
-        rechain_block(controller, (Header *)new_ptr);
+        // The block keeps its slot and site, only the pointer and the size change.
+        rebind_block(controller, (Header *)new_ptr, old_size);
 
         set_tail(new_ptr, alloc_size);
     }
@@ -248,8 +529,9 @@ MEM_realloc_func(MEM_Controller controller, const char *filename, int line, void
         // Re-alloc acts as malloc
         set_header(new_ptr, size, filename, line);
         set_tail(new_ptr, alloc_size);
-        chain_block(controller, (Header *)new_ptr);
+        register_block(controller, (Header *)new_ptr);
     }
+    scan_blocks(controller, controller->registry.check_rate);
     new_ptr = (char *)new_ptr + sizeof(Header);
     if (size > old_size) {
         memset((char *)new_ptr + old_size, 0xCC, size - old_size);
@@ -278,16 +560,20 @@ MEM_strdup_func(MEM_Controller controller, const char *filename, int line, const
     size_t alloc_size = size;
 #endif
 
-    char *ptr = malloc(alloc_size);
+    char *ptr = raw_alloc(controller, alloc_size);
     if (ptr == NULL) {
         error_handler(controller, filename, line, "strdup");
     }
+    else if (controller->profile != NULL) {
+        mem_sample_allocation(controller, filename, line, size);
+    }
 
 #ifdef DEBUG
     memset(ptr, 0xCC, alloc_size);
     set_header((Header *)ptr, size, filename, line);
     set_tail(ptr, alloc_size);
-    chain_block(controller, (Header *)ptr);
+    register_block(controller, (Header *)ptr);
+    scan_blocks(controller, controller->registry.check_rate);
     ptr = (char *)ptr + sizeof(Header);  // Jump the header
 #endif
     // TODO: check whether strcpy automatically insert '\0'?
@@ -308,13 +594,20 @@ MEM_free_func(MEM_Controller controller, void *ptr)
     void *real_ptr = (char *)ptr - sizeof(Header);
     check_mark((Header *)real_ptr);
     int size = ((Header *)real_ptr)->size;
-    unchain_block(controller, real_ptr);
+    unregister_block(controller, real_ptr);
     memset(real_ptr, 0xCC, size + sizeof(Header) + MARK_SIZE);
 #else
     void *real_ptr = ptr;
 #endif
 
-    free(real_ptr);
+    raw_free(controller, real_ptr);
+}
+
+
+void
+MEM_get_stats_func(MEM_Controller controller, MEM_Stats *stats)
+{
+    *stats = controller->stats;
 }
 
 
@@ -339,12 +632,19 @@ void
 MEM_dump_blocks_func(MEM_Controller controller, FILE *fp)
 {
 #ifdef DEBUG
-    int counter = 0;
-    for (Header *pos = controller->block_header; pos != NULL; pos = pos->next) {
+    BlockRegistry *registry = &controller->registry;
+    for (int i = 0; i < registry->block_num; i++) {
+        Header *pos = registry->block[i];
         check_mark(pos);
-        fprintf(fp, "[%04d]%p:\n", counter, (char *)pos + sizeof(Header));
+        fprintf(fp, "[%04d]%p:\n", i, (char *)pos + sizeof(Header));
         fprintf(fp, "allocater %s line %d size %d\n", pos->filename, pos->line, pos->size);
-        counter++;
+    }
+    for (int i = 0; i < registry->site_num; i++) {
+        BlockSite *site = &registry->site[i];
+        if (site->block_num > 0) {
+            fprintf(fp, "site %s line %d: %d blocks, %zu bytes\n",
+                    site->filename, site->line, site->block_num, site->bytes);
+        }
     }
 #endif
 }
@@ -364,9 +664,21 @@ void
 MEM_check_all_blocks_func(MEM_Controller controller, const char *filename, int line)
 {
 #ifdef DEBUG
-    for (Header *pos = controller->block_header; pos != NULL; pos = pos->next) {
-        check_mark(pos);
+    BlockRegistry *registry = &controller->registry;
+    for (int i = 0; i < registry->block_num; i++) {
+        check_mark(registry->block[i]);
     }
 #endif
 }
 
+
+// MEM_set_check_rate_func:
+//   Set how many blocks are checked on every allocation, 0 disables the scan.
+void
+MEM_set_check_rate_func(MEM_Controller controller, int blocks_per_alloc)
+{
+#ifdef DEBUG
+    controller->registry.check_rate = blocks_per_alloc;
+#endif
+}
+
@@ -4,12 +4,52 @@
 #include "MEM.h"
 
 typedef union Header_tag Header;
+typedef union FreeBlock_tag FreeBlock;
+typedef struct MemProfile_tag MemProfile;
+
+// Small blocks are served from per-size-class free lists.
+// Size classes are multiples of MEM_SIZE_CLASS_STEP up to
+// MEM_SIZE_CLASS_STEP * MEM_SIZE_CLASS_NUM bytes.
+#define MEM_SIZE_CLASS_STEP (16)
+#define MEM_SIZE_CLASS_NUM  (16)
+
+// DEBUG builds: blocks allocated from one (filename, line) pair.
+typedef struct {
+    const char *filename;
+    int         line;
+    int         block_num;
+    size_t      bytes;
+} BlockSite;
+
+// DEBUG builds: every live block sits in a dense array and remembers
+// its slot in Header.index, so adding and removing a block are O(1).
+// Sites are appended to `site' and found through the open addressing
+// table `site_slot', which holds site indices or -1.
+typedef struct {
+    Header **  block;
+    int        block_num;
+    int        block_capacity;
+    int        check_cursor;    // next slot of the incremental scan
+    int        check_rate;      // blocks scanned per allocation, 0 disables
+    BlockSite *site;
+    int        site_num;
+    int        site_capacity;
+    int *      site_slot;
+    int        site_slot_num;   // always a power of 2
+} BlockRegistry;
 
 struct MEM_Controller_tag {
     const char *     error_file;
     MEM_ErrorHandler error_handler;
     MEM_FailMode     fail_mode;
-    Header *         block_header;
+    BlockRegistry    registry;
+    FreeBlock *      free_list[MEM_SIZE_CLASS_NUM];
+    MEM_Stats        stats;
+    MemProfile *     profile;       // NULL unless sampling is enabled
+    const int *      context_line;  // reported along with each sample
 };
 
+// profile.c
+void mem_sample_allocation(MEM_Controller controller, const char *filename, int line, size_t size);
+
 #endif // MEMORY_MEMORY_H
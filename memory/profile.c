@@ -0,0 +1,198 @@
+// profile.c
+//   A sampling allocation profiler.
+//   One sample is taken every `sample_bytes' allocated bytes and charged to
+//   the allocating C site (filename, line) together with the value of the
+//   context line, which the interpreter points at its current source line.
+//   The tables use plain malloc so that the profiler never profiles itself.
+
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+#define SITE_TABLE_INIT_SIZE (256)
+
+
+typedef struct {
+    const char *filename;      // NULL marks an empty slot
+    int         line;
+    int         context_line;
+    long        sample_count;
+} Site;
+
+struct MemProfile_tag {
+    size_t     sample_bytes;
+    long       bytes_until_sample;
+    const int *context_line;
+    Site      *site;
+    int        site_capacity;  // always a power of 2
+    int        site_num;
+};
+
+
+static unsigned int
+hash_site(const char *filename, int line, int context_line)
+{
+    uintptr_t h = (uintptr_t)filename;
+    h = h * 31 + (unsigned int)line;
+    h = h * 31 + (unsigned int)context_line;
+    return (unsigned int)(h ^ (h >> 16));
+}
+
+
+static Site *
+find_site(Site *table, int capacity, const char *filename, int line, int context_line)
+{
+    unsigned int i = hash_site(filename, line, context_line) & (capacity - 1);
+    while (table[i].filename != NULL
+           && !(table[i].filename == filename && table[i].line == line
+                && table[i].context_line == context_line)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &table[i];
+}
+
+
+static int
+grow_site_table(MemProfile *profile)
+{
+    int new_capacity = profile->site_capacity * 2;
+    Site *new_site = calloc(new_capacity, sizeof(Site));
+    if (new_site == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < profile->site_capacity; i++) {
+        Site *old = &profile->site[i];
+        if (old->filename != NULL) {
+            *find_site(new_site, new_capacity, old->filename, old->line, old->context_line) = *old;
+        }
+    }
+    free(profile->site);
+    profile->site = new_site;
+    profile->site_capacity = new_capacity;
+    return 1;
+}
+
+
+static void
+record_sample(MemProfile *profile, const char *filename, int line, long count)
+{
+    int context_line = (profile->context_line != NULL) ? *profile->context_line : 0;
+
+    if (profile->site_num * 2 >= profile->site_capacity && !grow_site_table(profile)) {
+        return;
+    }
+    Site *site = find_site(profile->site, profile->site_capacity, filename, line, context_line);
+    if (site->filename == NULL) {
+        site->filename = filename;
+        site->line = line;
+        site->context_line = context_line;
+        profile->site_num++;
+    }
+    site->sample_count += count;
+}
+
+
+// mem_sample_allocation: called for every allocation while profiling.
+//   A large allocation may cover several sampling intervals at once.
+void
+mem_sample_allocation(MEM_Controller controller, const char *filename, int line, size_t size)
+{
+    MemProfile *profile = controller->profile;
+
+    profile->bytes_until_sample -= (long)size;
+    if (profile->bytes_until_sample > 0) {
+        return;
+    }
+
+    long count = 1 + (-profile->bytes_until_sample) / (long)profile->sample_bytes;
+    profile->bytes_until_sample += count * (long)profile->sample_bytes;
+    record_sample(profile, filename, line, count);
+}
+
+
+// MEM_enable_profile_func: start sampling one in every `sample_bytes' bytes.
+//   Calling it again resets the collected samples.
+void
+MEM_enable_profile_func(MEM_Controller controller, size_t sample_bytes)
+{
+    MemProfile *profile = controller->profile;
+
+    if (profile == NULL) {
+        profile = calloc(1, sizeof(MemProfile));
+        if (profile == NULL) {
+            return;
+        }
+    }
+    else {
+        free(profile->site);
+    }
+
+    profile->sample_bytes = (sample_bytes > 0) ? sample_bytes : 1;
+    profile->bytes_until_sample = (long)profile->sample_bytes;
+    profile->site_capacity = SITE_TABLE_INIT_SIZE;
+    profile->site_num = 0;
+    profile->site = calloc(profile->site_capacity, sizeof(Site));
+    if (profile->site == NULL) {
+        free(profile);
+        profile = NULL;
+    }
+    controller->profile = profile;
+    if (profile != NULL) {
+        profile->context_line = controller->context_line;
+    }
+}
+
+
+void
+MEM_set_profile_context_func(MEM_Controller controller, const int *context_line)
+{
+    controller->context_line = context_line;
+    if (controller->profile != NULL) {
+        controller->profile->context_line = context_line;
+    }
+}
+
+
+static int
+compare_site(const void *a, const void *b)
+{
+    long left = ((const Site *)a)->sample_count;
+    long right = ((const Site *)b)->sample_count;
+    return (left < right) - (left > right);
+}
+
+
+// MEM_dump_profile_func: print the sites, heaviest first.
+//   Estimated bytes are sample counts times the sampling interval.
+void
+MEM_dump_profile_func(MEM_Controller controller, FILE *fp)
+{
+    MemProfile *profile = controller->profile;
+    if (profile == NULL) {
+        return;
+    }
+
+    Site *sorted = malloc(sizeof(Site) * (profile->site_num + 1));
+    if (sorted == NULL) {
+        return;
+    }
+    int n = 0;
+    for (int i = 0; i < profile->site_capacity; i++) {
+        if (profile->site[i].filename != NULL) {
+            sorted[n++] = profile->site[i];
+        }
+    }
+    qsort(sorted, n, sizeof(Site), compare_site);
+
+    fprintf(fp, "MEM: allocation profile, 1 sample per %zu bytes\n", profile->sample_bytes);
+    fprintf(fp, "%12s %8s  %-24s %s\n", "est.bytes", "samples", "site", "source line");
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "%12ld %8ld  %-18s:%-5d %d\n",
+                sorted[i].sample_count * (long)profile->sample_bytes,
+                sorted[i].sample_count, sorted[i].filename, sorted[i].line,
+                sorted[i].context_line);
+    }
+    free(sorted);
+}
@@ -1,8 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
 #include "memory.h"
 
+#if defined(__linux__) || defined(__APPLE__) || defined(__unix__)
+#define USE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 typedef union {
     long l_dummy;
     double d_dummy;
@@ -20,77 +27,281 @@ typedef MemoryPage *MemoryPageList;
 struct MemoryPage_tag {
     int cell_num;         // 总内存块数量
     int use_cell_num;     // 已经分配出去的内存块数量
+    size_t map_size;      // mmap 映射的字节数, 为 0 表示由 MEM_malloc_func 分配
     MemoryPageList next;  // 链表结构
     Cell cell[1];         // 内存块指针
 };
 
 struct MEM_Storage_tag {
-    MemoryPageList page_list;  // 内存页链表
-    int current_page_size;     // 一个内存页所拥有的最少 cell 数量
+    MemoryPageList page_list;        // 内存页链表, 头部是当前正在分配的页
+    MemoryPageList large_page_list;  // 大块链表, 每个大块独占一页
+    MemoryPageList free_page_list;   // 回退到标记时保留下来待重用的内存页
+    int current_page_size;           // 一个内存页所拥有的最少 cell 数量
+    int is_mapped;                   // 普通页是否使用 mmap 映射
 };
 
-#define max(a, b) (((a) > (b)) ? (a) : (b))
+// 页头占用的字节数
+#define PAGE_HEADER_SIZE (offsetof(MemoryPage, cell))
 
-// Storage 模块位于 MEM_Controller 的管理之下
-// 本质上是一个构造函数
-// 只申请了存储器结构体所需要的空间, 没有申请存储器拥有的数据区空间
-// page_size > 0, 如果 page_size 为 0, 则设置默认的 page_size
-MEM_Storage
-MEM_open_storage_func(MEM_Controller controller, const char *filename, int line, int page_size)
+// 超过页大小 1/LARGE_CELL_RATIO 的申请作为大块单独分配
+#define LARGE_CELL_RATIO (4)
+
+static MEM_Storage
+open_storage(MEM_Controller controller, const char *filename, int line, int page_size, int is_mapped)
 {
     MEM_Storage storage;
 
     storage = MEM_malloc_func(controller, filename, line, sizeof(struct MEM_Storage_tag));
 
     storage->page_list = NULL;
+    storage->large_page_list = NULL;
+    storage->free_page_list = NULL;
+    storage->is_mapped = is_mapped;
     assert(page_size >= 0);
 
-    page_size = (page_size > 0) ? page_size : DEFAULT_PAGE_SIZE;
     storage->current_page_size = page_size;
 
     return storage;
 }
 
+// Storage 模块位于 MEM_Controller 的管理之下
+// 本质上是一个构造函数
+// 只申请了存储器结构体所需要的空间, 没有申请存储器拥有的数据区空间
+// page_size > 0, 如果 page_size 为 0, 则设置默认的 page_size
+MEM_Storage
+MEM_open_storage_func(MEM_Controller controller, const char *filename, int line, int page_size)
+{
+    page_size = (page_size > 0) ? page_size : DEFAULT_PAGE_SIZE;
+    return open_storage(controller, filename, line, page_size, 0);
+}
+
+// 与 MEM_open_storage_func 相同, 但是普通页用 mmap 直接向系统申请.
+// 映射区域向上取整到系统页 (足够大时取整到大页), 多出的部分也作为 cell 使用.
+// page_size 为 0 时一个页恰好占满一个大页.
+MEM_Storage
+MEM_open_mapped_storage_func(MEM_Controller controller, const char *filename, int line, int page_size)
+{
+    page_size = (page_size > 0) ? page_size
+                                : (int)((MEM_HUGE_PAGE_SIZE - PAGE_HEADER_SIZE) / CELL_SIZE);
+    return open_storage(controller, filename, line, page_size, 1);
+}
+
+#ifdef USE_MMAP
+// 映射一段匿名内存. 达到大页大小时先尝试 MAP_HUGETLB (需要系统预留大页),
+// 失败时退回普通映射, 并用 MADV_HUGEPAGE 请求透明大页.
+static void *
+map_region(size_t size)
+{
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (size % MEM_HUGE_PAGE_SIZE == 0) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (size % MEM_HUGE_PAGE_SIZE == 0) {
+            madvise(p, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    return p;
+}
+
+static MemoryPage *
+map_page(int cell_num)
+{
+    size_t size = PAGE_HEADER_SIZE + CELL_SIZE * cell_num;
+    size_t unit = (size >= MEM_HUGE_PAGE_SIZE) ? MEM_HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    size = (size + unit - 1) / unit * unit;
+
+    MemoryPage *page = map_region(size);
+    if (page != NULL) {
+        page->map_size = size;
+        page->cell_num = (size - PAGE_HEADER_SIZE) / CELL_SIZE;
+    }
+    return page;
+}
+#endif // USE_MMAP
+
+// 申请一个普通页, 优先从回退时保留的页中取
+static MemoryPage *
+alloc_page(MEM_Controller controller, const char *filename, int line, MEM_Storage storage)
+{
+    MemoryPage *page = NULL;
+    int cell_num = storage->current_page_size;
+
+    if (storage->free_page_list != NULL) {
+        page = storage->free_page_list;
+        storage->free_page_list = page->next;
+    }
+    else {
+#ifdef USE_MMAP
+        if (storage->is_mapped) {
+            page = map_page(cell_num);
+            if (page != NULL && controller->profile != NULL) {
+                mem_sample_allocation(controller, filename, line, page->map_size);
+            }
+        }
+#endif
+        if (page == NULL) {
+            // 页头 + 内存块占用空间. 因为页头中最后一个成员已经占有了一个 cell, 所以要 -1.
+            page = MEM_malloc_func(controller, filename, line,
+                    sizeof(MemoryPage) + CELL_SIZE * (cell_num - 1));
+            page->map_size = 0;
+            page->cell_num = cell_num;
+        }
+        controller->stats.storage_page_num++;
+        controller->stats.mapped_bytes += page->map_size;
+    }
+    page->use_cell_num = 0;
+    return page;
+}
+
+// 大块总是用 MEM_malloc_func 分配, 回退时直接释放
+static MemoryPage *
+alloc_large_page(MEM_Controller controller, const char *filename, int line, int cell_num)
+{
+    MemoryPage *page = MEM_malloc_func(controller, filename, line,
+            sizeof(MemoryPage) + CELL_SIZE * (cell_num - 1));
+    page->map_size = 0;
+    page->cell_num = cell_num;
+    page->use_cell_num = cell_num;
+    controller->stats.storage_page_num++;
+    return page;
+}
+
+static void
+free_page(MEM_Controller controller, MemoryPage *page)
+{
+    controller->stats.storage_page_num--;
+    controller->stats.mapped_bytes -= page->map_size;
+#ifdef USE_MMAP
+    if (page->map_size > 0) {
+        munmap(page, page->map_size);
+        return;
+    }
+#endif
+    MEM_free_func(controller, page);
+}
+
 void *
 MEM_storage_malloc_func(MEM_Controller controller, const char *filename, int line, MEM_Storage storage, size_t size)
 {
-    int cell_num = ((size - 1) / CELL_SIZE) + 1;  // (size / CELL_SIZE) 上去整
-
-    void *p;
-    if (storage->page_list != NULL
-            && (storage->page_list->use_cell_num + cell_num < storage->page_list->cell_num)) {
-        // 剩余内存块足够, 直接分配
-        p = &(storage->page_list->cell[storage->page_list->use_cell_num]);
-        storage->page_list->use_cell_num += cell_num;
+    int cell_num = (size > 0) ? ((size - 1) / CELL_SIZE) + 1 : 1;  // (size / CELL_SIZE) 上去整
+
+    if (cell_num > storage->current_page_size / LARGE_CELL_RATIO) {
+        // 大块单独成页, 挂在大块链表上, 不影响当前页继续分配
+        MemoryPage *large_page = alloc_large_page(controller, filename, line, cell_num);
+        large_page->next = storage->large_page_list;
+        storage->large_page_list = large_page;
+        return &(large_page->cell[0]);
     }
-    else {
-        // 现在要申请一块新的内存页, 如果申请的块大小超过了统一的页大小, 那么就按申请的来.
-        // 否则每个页的大小都是一样的.
-        int alloc_cell_num = max(cell_num, storage->current_page_size);
-        MemoryPage *new_page = MEM_malloc_func(controller, filename, line,
-                sizeof(MemoryPage) + CELL_SIZE * (alloc_cell_num - 1));
-        // 页头 + 内存块占用空间. 因为页头中最后一个成员已经占有了一个 cell, 所以要 -1.
+
+    if (storage->page_list == NULL
+            || storage->page_list->use_cell_num + cell_num > storage->page_list->cell_num) {
+        // 当前页剩余空间不够, 开启新页, 旧页剩下的空间计入浪费
+        MemoryPage *new_page = alloc_page(controller, filename, line, storage);
         // 头部插入链表
         new_page->next = storage->page_list;
         storage->page_list = new_page;
-
-        new_page->cell_num = alloc_cell_num;
-        new_page->use_cell_num = cell_num;
-        p = &(new_page->cell[0]);
     }
 
+    // 剩余内存块足够, 直接分配
+    void *p = &(storage->page_list->cell[storage->page_list->use_cell_num]);
+    storage->page_list->use_cell_num += cell_num;
+
     return p;
 }
 
-void
-MEM_dispose_storage_func(MEM_Controller controller, MEM_Storage storage)
+static void
+free_page_list(MEM_Controller controller, MemoryPageList list)
 {
     MemoryPage *page;
-    while (storage->page_list) {
-        page = storage->page_list;
-        storage->page_list = storage->page_list->next;
-        MEM_free_func(controller, page);
+    while (list) {
+        page = list;
+        list = list->next;
+        free_page(controller, page);
     }
+}
+
+void
+MEM_dispose_storage_func(MEM_Controller controller, MEM_Storage storage)
+{
+    free_page_list(controller, storage->page_list);
+    free_page_list(controller, storage->large_page_list);
+    free_page_list(controller, storage->free_page_list);
     MEM_free_func(controller, storage);
 }
 
+// 记录当前的分配位置: 链表头部的页以及其中已经分配的 cell 数量, 还有大块链表的头部
+MEM_StorageMark
+MEM_storage_mark_func(MEM_Storage storage)
+{
+    MEM_StorageMark mark;
+    mark.page = storage->page_list;
+    mark.large_page = storage->large_page_list;
+    mark.use_cell_num = (storage->page_list != NULL) ? storage->page_list->use_cell_num : 0;
+    return mark;
+}
+
+// 回退到 mark 记录的分配位置, 之后分配的空间全部失效.
+// 新页总是插入在链表头部, 所以标记之后的页都在标记页之前.
+// 普通页留待重用, 大块直接释放.
+// 标记必须按照后进先出的顺序回退.
+void
+MEM_storage_release_to_mark_func(MEM_Controller controller, MEM_Storage storage, MEM_StorageMark mark)
+{
+    while (storage->page_list != mark.page) {
+        MemoryPage *page = storage->page_list;
+        assert(page != NULL);
+        storage->page_list = page->next;
+        page->next = storage->free_page_list;
+        storage->free_page_list = page;
+    }
+
+    while (storage->large_page_list != mark.large_page) {
+        MemoryPage *page = storage->large_page_list;
+        assert(page != NULL);
+        storage->large_page_list = page->next;
+        free_page(controller, page);
+    }
+
+    if (storage->page_list != NULL) {
+        assert(storage->page_list->use_cell_num >= mark.use_cell_num);
+        storage->page_list->use_cell_num = mark.use_cell_num;
+    }
+}
+
+// 统计存储器的空间使用情况.
+// 当前页之外的普通页不会再被分配, 它们剩余的空间就是浪费.
+void
+MEM_storage_stats_func(MEM_Storage storage, MEM_StorageStats *stats)
+{
+    stats->page_num = 0;
+    stats->large_page_num = 0;
+    stats->free_page_num = 0;
+    stats->used_bytes = 0;
+    stats->wasted_bytes = 0;
+    stats->large_bytes = 0;
+
+    for (MemoryPage *page = storage->page_list; page != NULL; page = page->next) {
+        stats->page_num++;
+        stats->used_bytes += page->use_cell_num * CELL_SIZE;
+        if (page != storage->page_list) {
+            stats->wasted_bytes += (page->cell_num - page->use_cell_num) * CELL_SIZE;
+        }
+    }
+    for (MemoryPage *page = storage->large_page_list; page != NULL; page = page->next) {
+        stats->large_page_num++;
+        stats->large_bytes += page->cell_num * CELL_SIZE;
+    }
+    for (MemoryPage *page = storage->free_page_list; page != NULL; page = page->next) {
+        stats->free_page_num++;
+    }
+}
@@ -3,12 +3,51 @@
 #include "crowbar.h"
 #include "CRB_dev.h"
 #include "DBG.h"
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
 
 #define NATIVE_LIB_NAME "crowbar.lang.file"
 
-static CRB_NativePointerInfo st_native_lib_info = {
-    NATIVE_LIB_NAME
-};
+// 把值的文本表示写到 fp, print 和文件的 write 方法共用
+static void
+write_value(FILE *fp, CRB_Value *arg)
+{
+    switch (arg->type) {
+        case CRB_BOOLEAN_VALUE:
+            if (arg->u.boolean_value == CRB_TRUE) {
+                fprintf(fp, "true");
+            }
+            else {
+                fprintf(fp, "false");
+            }
+            break;
+        case CRB_INT_VALUE:
+            fprintf(fp, "%d", arg->u.int_value);
+            break;
+        case CRB_DOUBLE_VALUE:
+            fprintf(fp, "%f", arg->u.double_value);
+            break;
+        case CRB_STRING_VALUE:
+            fwrite(arg->u.string_value->string, 1, arg->u.string_value->length, fp);
+            break;
+        case CRB_NATIVE_POINTER_VALUE:
+            fprintf(fp, "(%s:%p)", arg->u.native_pointer.info->name, arg->u.native_pointer.pointer);
+            break;
+        case CRB_NULL_VALUE:
+            fprintf(fp, "(null)");
+            break;
+        case CRB_ARRAY_VALUE:
+        case CRB_MAP_VALUE:
+        case CRB_TYPED_ARRAY_VALUE:
+        case CRB_RECORD_VALUE: {
+            CRB_String *str = crb_container_to_string(arg);
+            fwrite(str->string, 1, str->length, fp);
+            crb_release_string(str);
+            break;
+        }
+    }
+}
 
 /**
  * 内置打印函数
@@ -22,49 +61,987 @@ crb_native_print(CRB_Interpreter *interpreter,
     CRB_Value value = { .type = CRB_NULL_VALUE };
 
     DBG_assert(argc == 1, "argument miss match");
-    
-    CRB_Value arg = args[0];
-    switch (arg.type) {
-        case CRB_BOOLEAN_VALUE:
-            if (arg.u.boolean_value == CRB_TRUE) {
-                printf("true");
-            }
-            else {
-                printf("false");
-            }
-            break;
-        case CRB_INT_VALUE:
-            printf("%d", arg.u.int_value);
-            break;
-        case CRB_DOUBLE_VALUE:
-            printf("%f", arg.u.double_value);
+    write_value(stdout, &args[0]);
+
+    return value;
+}
+
+/**
+ * 驻留字符串, 返回内容相同的规范字符串, 非字符串参数原样返回.
+ * 参数在调用结束后会被释放, 所以先增加一次引用再交给驻留表.
+ */
+CRB_Value
+crb_native_intern(CRB_Interpreter *interpreter,
+                  int              argc,
+                  CRB_Value       *args)
+{
+    DBG_assert(argc == 1, "argument miss match");
+
+    CRB_Value value = args[0];
+    if (value.type == CRB_STRING_VALUE) {
+        crb_refer_string(value.u.string_value);
+        value.u.string_value = crb_intern_string(value.u.string_value);
+    }
+    return value;
+}
+
+static CRB_Value
+string_value(CRB_String *str)
+{
+    CRB_Value value = {
+        .type = CRB_STRING_VALUE,
+        .u.string_value = str,
+    };
+    return value;
+}
+
+/**
+ * substr(s, start [, length])
+ * 越界的范围会被截断到字符串以内
+ */
+CRB_Value
+crb_native_substr(CRB_Interpreter *interpreter,
+                  int              argc,
+                  CRB_Value       *args)
+{
+    DBG_assert(argc == 2 || argc == 3, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE && args[1].type == CRB_INT_VALUE,
+               "bad argument type");
+
+    CRB_String *str = args[0].u.string_value;
+    int start = max(0, min(args[1].u.int_value, str->length));
+    int length = str->length - start;
+    if (argc == 3) {
+        DBG_assert(args[2].type == CRB_INT_VALUE, "bad argument type");
+        length = max(0, min(args[2].u.int_value, length));
+    }
+
+    return string_value(crb_create_string_view(str, start, length));
+}
+
+/**
+ * trim(s), 去掉首尾的空白字符
+ */
+CRB_Value
+crb_native_trim(CRB_Interpreter *interpreter,
+                int              argc,
+                CRB_Value       *args)
+{
+    DBG_assert(argc == 1, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE, "bad argument type");
+
+    CRB_String *str = args[0].u.string_value;
+    int begin = 0;
+    int end = str->length;
+    while (begin < end && isspace((unsigned char)str->string[begin])) {
+        begin++;
+    }
+    while (end > begin && isspace((unsigned char)str->string[end - 1])) {
+        end--;
+    }
+
+    return string_value(crb_create_string_view(str, begin, end - begin));
+}
+
+/**
+ * split(s, sep) 返回以 sep 分割的所有字段组成的数组
+ */
+static CRB_Value
+split_all(CRB_Interpreter *interpreter, CRB_String *str, CRB_String *sep)
+{
+    CRB_Value value = {
+        .type = CRB_ARRAY_VALUE,
+        .u.array_value = crb_create_array(interpreter, 0),
+    };
+
+    int begin = 0;
+    for (;;) {
+        int end = crb_search_string(str, begin, sep);
+        if (end < 0) {
+            end = str->length;
+        }
+        CRB_Value field = string_value(crb_create_string_view(str, begin, end - begin));
+        crb_array_add(interpreter, value.u.array_value, &field);
+        crb_release_value(&field);
+        if (end == str->length) {
             break;
-        case CRB_STRING_VALUE:
-            printf("%s", arg.u.string_value->string);
+        }
+        begin = end + sep->length;
+    }
+
+    return value;
+}
+
+/**
+ * split(s, sep, n), 返回以 sep 分割的第 n 个字段 (从 0 开始), 不存在时返回 null.
+ * split(s, sep) 返回所有字段组成的数组
+ */
+CRB_Value
+crb_native_split(CRB_Interpreter *interpreter,
+                 int              argc,
+                 CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 2 || argc == 3, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE && args[1].type == CRB_STRING_VALUE,
+               "bad argument type");
+
+    CRB_String *str = args[0].u.string_value;
+    CRB_String *sep = args[1].u.string_value;
+    DBG_assert(sep->length > 0, "empty separator");
+
+    if (argc == 2) {
+        return split_all(interpreter, str, sep);
+    }
+    DBG_assert(args[2].type == CRB_INT_VALUE, "bad argument type");
+
+    int begin = 0;
+    for (int n = args[2].u.int_value; n >= 0; n--) {
+        int end = crb_search_string(str, begin, sep);
+        if (end < 0) {
+            end = str->length;
+        }
+        if (n == 0) {
+            value = string_value(crb_create_string_view(str, begin, end - begin));
             break;
-        case CRB_NATIVE_POINTER_VALUE:
-            printf("(%s:%p)", arg.u.native_pointer.info->name, arg.u.native_pointer.pointer);
+        }
+        if (end == str->length) {
             break;
-        case CRB_NULL_VALUE:
-            printf("(null)");
+        }
+        begin = end + sep->length;
+    }
+
+    return value;
+}
+
+/**
+ * find(s, pattern [, from]), 返回 pattern 第一次出现的下标, 没有找到时返回 -1
+ */
+CRB_Value
+crb_native_find(CRB_Interpreter *interpreter,
+                int              argc,
+                CRB_Value       *args)
+{
+    DBG_assert(argc == 2 || argc == 3, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE && args[1].type == CRB_STRING_VALUE,
+               "bad argument type");
+
+    int from = 0;
+    if (argc == 3) {
+        DBG_assert(args[2].type == CRB_INT_VALUE, "bad argument type");
+        from = max(0, args[2].u.int_value);
+    }
+
+    CRB_Value value = {
+        .type = CRB_INT_VALUE,
+        .u.int_value = crb_search_string(args[0].u.string_value, from, args[1].u.string_value),
+    };
+    return value;
+}
+
+/**
+ * count(s, pattern), 统计 pattern 不重叠出现的次数
+ */
+CRB_Value
+crb_native_count(CRB_Interpreter *interpreter,
+                 int              argc,
+                 CRB_Value       *args)
+{
+    DBG_assert(argc == 2, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE && args[1].type == CRB_STRING_VALUE,
+               "bad argument type");
+
+    CRB_String *str = args[0].u.string_value;
+    CRB_String *pattern = args[1].u.string_value;
+    DBG_assert(pattern->length > 0, "empty pattern");
+
+    int count = 0;
+    for (int pos = crb_search_string(str, 0, pattern); pos >= 0;
+         pos = crb_search_string(str, pos + pattern->length, pattern)) {
+        count++;
+    }
+
+    CRB_Value value = {
+        .type = CRB_INT_VALUE,
+        .u.int_value = count,
+    };
+    return value;
+}
+
+/**
+ * replace(s, old, new), 替换所有不重叠出现的 old.
+ * 先数出现次数确定结果长度, 只分配一次
+ */
+CRB_Value
+crb_native_replace(CRB_Interpreter *interpreter,
+                   int              argc,
+                   CRB_Value       *args)
+{
+    DBG_assert(argc == 3, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE && args[1].type == CRB_STRING_VALUE
+               && args[2].type == CRB_STRING_VALUE, "bad argument type");
+
+    CRB_String *str = args[0].u.string_value;
+    CRB_String *from = args[1].u.string_value;
+    CRB_String *to = args[2].u.string_value;
+    DBG_assert(from->length > 0, "empty pattern");
+
+    int count = crb_native_count(interpreter, 2, args).u.int_value;
+    if (count == 0) {
+        crb_refer_string(str);
+        return string_value(str);
+    }
+
+    CRB_String *ret = crb_alloc_crb_string(str->length + count * (to->length - from->length));
+    char *dest = ret->string;
+    int begin = 0;
+    for (int pos = crb_search_string(str, 0, from); pos >= 0;
+         pos = crb_search_string(str, begin, from)) {
+        memcpy(dest, str->string + begin, pos - begin);
+        dest += pos - begin;
+        memcpy(dest, to->string, to->length);
+        dest += to->length;
+        begin = pos + from->length;
+    }
+    memcpy(dest, str->string + begin, str->length - begin);
+    dest[str->length - begin] = '\0';
+
+    return string_value(ret);
+}
+
+/**
+ * starts_with(s, prefix)
+ */
+CRB_Value
+crb_native_starts_with(CRB_Interpreter *interpreter,
+                       int              argc,
+                       CRB_Value       *args)
+{
+    DBG_assert(argc == 2, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE && args[1].type == CRB_STRING_VALUE,
+               "bad argument type");
+
+    CRB_String *str = args[0].u.string_value;
+    CRB_String *prefix = args[1].u.string_value;
+
+    CRB_Value value = {
+        .type = CRB_BOOLEAN_VALUE,
+        .u.boolean_value = (prefix->length <= str->length
+                            && !memcmp(str->string, prefix->string, prefix->length))
+                           ? CRB_TRUE : CRB_FALSE,
+    };
+    return value;
+}
+
+/**
+ * 去掉首尾空白后的字符范围, 供数值解析使用
+ */
+static void
+strip_space(CRB_String *str, const char **begin, int *len)
+{
+    int head = 0;
+    int tail = str->length;
+    while (head < tail && isspace((unsigned char)str->string[head])) {
+        head++;
+    }
+    while (tail > head && isspace((unsigned char)str->string[tail - 1])) {
+        tail--;
+    }
+    *begin = str->string + head;
+    *len = tail - head;
+}
+
+/**
+ * parse_int(s), 不是合法的十进制整数或者溢出时返回 null
+ */
+CRB_Value
+crb_native_parse_int(CRB_Interpreter *interpreter,
+                     int              argc,
+                     CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 1, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE, "bad argument type");
+
+    const char *begin;
+    int len;
+    strip_space(args[0].u.string_value, &begin, &len);
+    if (crb_parse_int(begin, len, &value.u.int_value)) {
+        value.type = CRB_INT_VALUE;
+    }
+    return value;
+}
+
+/**
+ * parse_double(s), 不是合法的浮点数时返回 null
+ */
+CRB_Value
+crb_native_parse_double(CRB_Interpreter *interpreter,
+                        int              argc,
+                        CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 1, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE, "bad argument type");
+
+    const char *begin;
+    int len;
+    strip_space(args[0].u.string_value, &begin, &len);
+    if (crb_parse_double(begin, len, &value.u.double_value)) {
+        value.type = CRB_DOUBLE_VALUE;
+    }
+    return value;
+}
+
+// 统计函数的一个计数器
+typedef struct {
+    const char *name;
+    long        value;
+} StatCounter;
+
+/**
+ * mem_stats 和 gc_stats 共用: 没有参数时返回所有计数器的汇总字符串,
+ * 有参数时返回名为 args[0] 的计数器 (超过 int 范围时取 INT_MAX), 未知的名字返回 null
+ */
+static CRB_Value
+stat_counter_value(int          argc,
+                   CRB_Value   *args,
+                   StatCounter *counters,
+                   int          counter_num)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 0 || argc == 1, "argument miss match");
+    if (argc == 0) {
+        char buf[LINE_BUF_SIZE];
+        int len = 0;
+        for (int i = 0; i < counter_num; i++) {
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%s=%ld",
+                            (i > 0) ? " " : "", counters[i].name, counters[i].value);
+        }
+        value = string_value(crb_copy_crb_string(buf));
+    }
+    else {
+        DBG_assert(args[0].type == CRB_STRING_VALUE, "bad argument type");
+        const char *name = crb_string_to_c(args[0].u.string_value);
+        for (int i = 0; i < counter_num; i++) {
+            if (!strcmp(name, counters[i].name)) {
+                value.type = CRB_INT_VALUE;
+                value.u.int_value = (int)min(counters[i].value, INT_MAX);
+                break;
+            }
+        }
+    }
+
+    return value;
+}
+
+/**
+ * mem_stats() 返回内存统计的汇总字符串,
+ * mem_stats(name) 返回名为 name 的计数器, 名字与 MEM_Stats 的成员名相同, 未知的名字返回 null
+ */
+CRB_Value
+crb_native_mem_stats(CRB_Interpreter *interpreter,
+                     int              argc,
+                     CRB_Value       *args)
+{
+    MEM_Stats stats;
+    MEM_get_stats(&stats);
+
+    StatCounter counters[] = {
+        { "live_bytes",       (long)stats.live_bytes },
+        { "peak_bytes",       (long)stats.peak_bytes },
+        { "alloc_count",      stats.alloc_count },
+        { "free_count",       stats.free_count },
+        { "storage_page_num", stats.storage_page_num },
+        { "mapped_bytes",     (long)stats.mapped_bytes },
+    };
+    return stat_counter_value(argc, args, counters, sizeof(counters) / sizeof(counters[0]));
+}
+
+/**
+ * gc_stats() 返回回收器统计的汇总字符串,
+ * gc_stats(name) 返回名为 name 的计数器, 名字与 CRB_GCStats 的成员名相同, 未知的名字返回 null
+ */
+CRB_Value
+crb_native_gc_stats(CRB_Interpreter *interpreter,
+                    int              argc,
+                    CRB_Value       *args)
+{
+    CRB_GCStats stats;
+    CRB_get_gc_stats(interpreter, &stats);
+
+    StatCounter counters[] = {
+        { "cycle_count",    stats.cycle_count },
+        { "pause_count",    stats.pause_count },
+        { "total_pause_ns", stats.total_pause_ns },
+        { "max_pause_ns",   stats.max_pause_ns },
+        { "last_pause_ns",  stats.last_pause_ns },
+        { "freed_count",    stats.freed_count },
+        { "live_bytes",     (long)stats.live_bytes },
+    };
+    return stat_counter_value(argc, args, counters, sizeof(counters) / sizeof(counters[0]));
+}
+
+/**
+ * mem_profile() 把采样分配剖析的结果输出到标准错误, 未开启剖析时什么也不做
+ */
+CRB_Value
+crb_native_mem_profile(CRB_Interpreter *interpreter,
+                       int              argc,
+                       CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 0, "argument miss match");
+    MEM_dump_profile(stderr);
+    return value;
+}
+
+/**
+ * 文件值指向一个 FileBox 而不是直接指向 FILE. 关闭时把 fp 置为 NULL,
+ * 引用同一个文件的所有值都能看到它已关闭. FileBox 分配在解释器的存储器中, 不单独释放
+ */
+typedef struct {
+    FILE *fp;
+} FileBox;
+
+static CRB_NativePointerInfo st_native_lib_info;
+
+static CRB_Value
+file_value(CRB_Interpreter *interpreter, FILE *fp)
+{
+    FileBox *box = MEM_storage_malloc(interpreter->interpreter_storage, sizeof(FileBox));
+    box->fp = fp;
+
+    CRB_Value value;
+    value.type = CRB_NATIVE_POINTER_VALUE;
+    value.u.native_pointer.info = &st_native_lib_info;
+    value.u.native_pointer.pointer = box;
+    return value;
+}
+
+/**
+ * 文件的方法, args[0] 是文件本身. 对已关闭的文件调用方法是运行时错误
+ */
+static FILE *
+file_arg(CRB_Interpreter *interpreter, CRB_Value *arg)
+{
+    DBG_assert(arg->type == CRB_NATIVE_POINTER_VALUE, "bad argument type");
+    FileBox *box = arg->u.native_pointer.pointer;
+    if (box->fp == NULL) {
+        crb_runtime_error(interpreter->current_line_number, "file is already closed");
+    }
+    return box->fp;
+}
+
+// file.write(v), 写入 v 的文本表示, 返回 null
+static CRB_Value
+file_write(CRB_Interpreter *interpreter,
+           int              argc,
+           CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 2, "argument miss match");
+    write_value(file_arg(interpreter, &args[0]), &args[1]);
+    return value;
+}
+
+// file.read_line(), 返回包括换行符在内的一行, 到达文件末尾时返回 null
+static CRB_Value
+file_read_line(CRB_Interpreter *interpreter,
+               int              argc,
+               CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+    char buf[LINE_BUF_SIZE];
+    char *line = NULL;
+    int length = 0;
+
+    DBG_assert(argc == 1, "argument miss match");
+    FILE *fp = file_arg(interpreter, &args[0]);
+    // 超过缓冲区的长行分多次读入
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        int len = strlen(buf);
+        line = MEM_realloc(line, length + len);
+        memcpy(line + length, buf, len);
+        length += len;
+        if (buf[len - 1] == '\n') {
             break;
+        }
     }
 
+    if (line != NULL) {
+        CRB_String *str = crb_alloc_crb_string(length);
+        memcpy(str->string, line, length);
+        str->string[length] = '\0';
+        MEM_free(line);
+        value = string_value(str);
+    }
+    return value;
+}
+
+// file.flush(), 返回 null
+static CRB_Value
+file_flush(CRB_Interpreter *interpreter,
+           int              argc,
+           CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 1, "argument miss match");
+    fflush(file_arg(interpreter, &args[0]));
+    return value;
+}
+
+// file.close(), 返回 null
+static CRB_Value
+file_close(CRB_Interpreter *interpreter,
+           int              argc,
+           CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 1, "argument miss match");
+    fclose(file_arg(interpreter, &args[0]));
+    ((FileBox *)args[0].u.native_pointer.pointer)->fp = NULL;
+    return value;
+}
+
+static CRB_NativeMethod st_file_method[] = {
+    { "write",     file_write },
+    { "read_line", file_read_line },
+    { "flush",     file_flush },
+    { "close",     file_close },
+    { NULL,        NULL },
+};
+
+static CRB_NativePointerInfo st_native_lib_info = {
+    .name = NATIVE_LIB_NAME,
+    .method = st_file_method,
+};
+
+/**
+ * fopen(path, mode), 参数含义同 C 的 fopen, 打开失败时返回 null
+ */
+CRB_Value
+crb_native_fopen(CRB_Interpreter *interpreter,
+                 int              argc,
+                 CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 2, "argument miss match");
+    DBG_assert(args[0].type == CRB_STRING_VALUE && args[1].type == CRB_STRING_VALUE,
+               "bad argument type");
+
+    FILE *fp = fopen(crb_string_to_c(args[0].u.string_value), crb_string_to_c(args[1].u.string_value));
+    if (fp != NULL) {
+        value = file_value(interpreter, fp);
+    }
     return value;
 }
 
 void crb_add_std_fp(CRB_Interpreter *interpreter)
 {
     CRB_Value fp_value;
-    fp_value.type = CRB_NATIVE_POINTER_VALUE;
-    fp_value.u.native_pointer.info = &st_native_lib_info;
 
-    fp_value.u.native_pointer.pointer = stdin;
+    fp_value = file_value(interpreter, stdin);
     CRB_add_global_variable(interpreter, "STDIN", &fp_value);
 
-    fp_value.u.native_pointer.pointer = stdout;
+    fp_value = file_value(interpreter, stdout);
     CRB_add_global_variable(interpreter, "STDOUT", &fp_value);
 
-    fp_value.u.native_pointer.pointer = stderr;
+    fp_value = file_value(interpreter, stderr);
     CRB_add_global_variable(interpreter, "STDERR", &fp_value);
 }
+
+static void add_typed_array(CRB_Interpreter *interpreter, CRB_Value *args);
+
+/**
+ * add(array, value), 在数组末尾追加 value, 返回 null.
+ * add(a, b), a 和 b 都是数值数组时把 b 逐个元素加到 a 上
+ */
+CRB_Value
+crb_native_add(CRB_Interpreter *interpreter,
+               int              argc,
+               CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 2, "argument miss match");
+    if (args[0].type == CRB_TYPED_ARRAY_VALUE) {
+        add_typed_array(interpreter, args);
+        return value;
+    }
+    DBG_assert(args[0].type == CRB_ARRAY_VALUE, "bad argument type");
+
+    crb_array_add(interpreter, args[0].u.array_value, &args[1]);
+    return value;
+}
+
+/**
+ * size(array) 返回数组 (包括数值数组) 的元素个数, size(map) 返回映射的键数, size(s) 返回字符串的长度
+ */
+CRB_Value
+crb_native_size(CRB_Interpreter *interpreter,
+                int              argc,
+                CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_INT_VALUE };
+
+    DBG_assert(argc == 1, "argument miss match");
+    if (args[0].type == CRB_ARRAY_VALUE) {
+        value.u.int_value = args[0].u.array_value->size;
+    }
+    else if (args[0].type == CRB_MAP_VALUE) {
+        value.u.int_value = args[0].u.map_value->count;
+    }
+    else if (args[0].type == CRB_TYPED_ARRAY_VALUE) {
+        value.u.int_value = args[0].u.typed_array_value->size;
+    }
+    else {
+        DBG_assert(args[0].type == CRB_STRING_VALUE, "bad argument type");
+        value.u.int_value = args[0].u.string_value->length;
+    }
+    return value;
+}
+
+/**
+ * get(map, key [, default]), key 不存在时返回 default, 没有给出 default 时返回 null
+ */
+CRB_Value
+crb_native_get(CRB_Interpreter *interpreter,
+               int              argc,
+               CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 2 || argc == 3, "argument miss match");
+    DBG_assert(args[0].type == CRB_MAP_VALUE, "bad argument type");
+
+    CRB_Value *found = crb_map_get(args[0].u.map_value, &args[1]);
+    if (found != NULL) {
+        value = *found;
+    }
+    else if (argc == 3) {
+        value = args[2];
+    }
+    crb_refer_value(&value);
+    return value;
+}
+
+/**
+ * put(map, key, value), 返回 null
+ */
+CRB_Value
+crb_native_put(CRB_Interpreter *interpreter,
+               int              argc,
+               CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 3, "argument miss match");
+    DBG_assert(args[0].type == CRB_MAP_VALUE, "bad argument type");
+
+    crb_map_put(interpreter, args[0].u.map_value, &args[1], &args[2]);
+    return value;
+}
+
+/**
+ * remove(map, key), 返回 key 是否存在
+ */
+CRB_Value
+crb_native_remove(CRB_Interpreter *interpreter,
+                  int              argc,
+                  CRB_Value       *args)
+{
+    DBG_assert(argc == 2, "argument miss match");
+    DBG_assert(args[0].type == CRB_MAP_VALUE, "bad argument type");
+
+    CRB_Value value = {
+        .type = CRB_BOOLEAN_VALUE,
+        .u.boolean_value = crb_map_remove(args[0].u.map_value, &args[1]),
+    };
+    return value;
+}
+
+/**
+ * keys(map), 返回所有键组成的数组, 顺序不确定
+ */
+CRB_Value
+crb_native_keys(CRB_Interpreter *interpreter,
+                int              argc,
+                CRB_Value       *args)
+{
+    DBG_assert(argc == 1, "argument miss match");
+    DBG_assert(args[0].type == CRB_MAP_VALUE, "bad argument type");
+
+    CRB_Map *map = args[0].u.map_value;
+    CRB_Value value = {
+        .type = CRB_ARRAY_VALUE,
+        .u.array_value = crb_create_array(interpreter, map->count),
+    };
+    int n = 0;
+    for (int i = 0; i < map->capacity; i++) {
+        if (map->entry[i].distance != 0) {
+            value.u.array_value->element[n] = map->entry[i].key;
+            crb_refer_value(&value.u.array_value->element[n]);
+            crb_gc_write_barrier(interpreter, &value.u.array_value->element[n]);
+            n++;
+        }
+    }
+    return value;
+}
+
+/**
+ * 数值数组相关的内置函数. 批量运算交给 crb_numeric_kernels() 选出的内核
+ */
+static CRB_TypedArray *
+typed_array_arg(CRB_Value *arg)
+{
+    DBG_assert(arg->type == CRB_TYPED_ARRAY_VALUE, "bad argument type");
+    return arg->u.typed_array_value;
+}
+
+static double
+number_arg(CRB_Value *arg)
+{
+    if (arg->type == CRB_INT_VALUE) {
+        return arg->u.int_value;
+    }
+    DBG_assert(arg->type == CRB_DOUBLE_VALUE, "bad argument type");
+    return arg->u.double_value;
+}
+
+static int
+int_arg(CRB_Interpreter *interpreter, CRB_Value *arg)
+{
+    if (arg->type != CRB_INT_VALUE) {
+        crb_runtime_error(interpreter->current_line_number, "int array operand must be an int");
+    }
+    return arg->u.int_value;
+}
+
+// 二元运算的两个数值数组必须元素类型相同, 长度相同
+static void
+check_same_shape(CRB_Interpreter *interpreter, CRB_TypedArray *left, CRB_TypedArray *right)
+{
+    if (left->element_type != right->element_type) {
+        crb_runtime_error(interpreter->current_line_number, "typed array element types differ");
+    }
+    if (left->size != right->size) {
+        crb_runtime_error(interpreter->current_line_number,
+                          "typed array sizes differ (%d and %d)", left->size, right->size);
+    }
+}
+
+static void
+add_typed_array(CRB_Interpreter *interpreter, CRB_Value *args)
+{
+    CRB_TypedArray *dest = typed_array_arg(&args[0]);
+    CRB_TypedArray *src = typed_array_arg(&args[1]);
+    const NumericKernels *kernels = crb_numeric_kernels();
+
+    check_same_shape(interpreter, dest, src);
+    if (dest->element_type == CRB_INT_ELEMENT) {
+        kernels->add_int(dest->u.int_element, src->u.int_element, dest->size);
+    }
+    else {
+        kernels->add_double(dest->u.double_element, src->u.double_element, dest->size);
+    }
+}
+
+// int_array(n) 和 double_array(n) 创建 n 个 0, 参数是数组时逐个转换其中的元素
+static CRB_Value
+create_typed_array(CRB_Interpreter *interpreter, CRB_ElementType element_type, CRB_Value *arg)
+{
+    CRB_Value value = { .type = CRB_TYPED_ARRAY_VALUE };
+
+    if (arg->type == CRB_INT_VALUE) {
+        if (arg->u.int_value < 0) {
+            crb_runtime_error(interpreter->current_line_number,
+                              "negative array size %d", arg->u.int_value);
+        }
+        value.u.typed_array_value = crb_create_typed_array(interpreter, element_type, arg->u.int_value);
+    }
+    else {
+        DBG_assert(arg->type == CRB_ARRAY_VALUE, "bad argument type");
+        CRB_Array *array = arg->u.array_value;
+        value.u.typed_array_value = crb_create_typed_array(interpreter, element_type, array->size);
+        for (int i = 0; i < array->size; i++) {
+            crb_typed_array_set(value.u.typed_array_value, i, &array->element[i]);
+        }
+    }
+    return value;
+}
+
+CRB_Value
+crb_native_int_array(CRB_Interpreter *interpreter,
+                     int              argc,
+                     CRB_Value       *args)
+{
+    DBG_assert(argc == 1, "argument miss match");
+    return create_typed_array(interpreter, CRB_INT_ELEMENT, &args[0]);
+}
+
+CRB_Value
+crb_native_double_array(CRB_Interpreter *interpreter,
+                        int              argc,
+                        CRB_Value       *args)
+{
+    DBG_assert(argc == 1, "argument miss match");
+    return create_typed_array(interpreter, CRB_DOUBLE_ELEMENT, &args[0]);
+}
+
+/**
+ * sum(a), int 数组的和按 32 位回绕, 与 int 加法一致. 空数组的和为 0
+ */
+CRB_Value
+crb_native_sum(CRB_Interpreter *interpreter,
+               int              argc,
+               CRB_Value       *args)
+{
+    CRB_Value value;
+
+    DBG_assert(argc == 1, "argument miss match");
+    CRB_TypedArray *array = typed_array_arg(&args[0]);
+    if (array->element_type == CRB_INT_ELEMENT) {
+        value.type = CRB_INT_VALUE;
+        value.u.int_value = crb_numeric_kernels()->sum_int(array->u.int_element, array->size);
+    }
+    else {
+        value.type = CRB_DOUBLE_VALUE;
+        value.u.double_value = crb_numeric_kernels()->sum_double(array->u.double_element, array->size);
+    }
+    return value;
+}
+
+/**
+ * min(a), 空数组返回 null
+ */
+CRB_Value
+crb_native_min(CRB_Interpreter *interpreter,
+               int              argc,
+               CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 1, "argument miss match");
+    CRB_TypedArray *array = typed_array_arg(&args[0]);
+    if (array->size == 0) {
+        return value;
+    }
+    if (array->element_type == CRB_INT_ELEMENT) {
+        value.type = CRB_INT_VALUE;
+        value.u.int_value = crb_numeric_kernels()->min_int(array->u.int_element, array->size);
+    }
+    else {
+        value.type = CRB_DOUBLE_VALUE;
+        value.u.double_value = crb_numeric_kernels()->min_double(array->u.double_element, array->size);
+    }
+    return value;
+}
+
+/**
+ * max(a), 空数组返回 null
+ */
+CRB_Value
+crb_native_max(CRB_Interpreter *interpreter,
+               int              argc,
+               CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 1, "argument miss match");
+    CRB_TypedArray *array = typed_array_arg(&args[0]);
+    if (array->size == 0) {
+        return value;
+    }
+    if (array->element_type == CRB_INT_ELEMENT) {
+        value.type = CRB_INT_VALUE;
+        value.u.int_value = crb_numeric_kernels()->max_int(array->u.int_element, array->size);
+    }
+    else {
+        value.type = CRB_DOUBLE_VALUE;
+        value.u.double_value = crb_numeric_kernels()->max_double(array->u.double_element, array->size);
+    }
+    return value;
+}
+
+/**
+ * dot(a, b), 两个数组的元素类型和长度必须相同
+ */
+CRB_Value
+crb_native_dot(CRB_Interpreter *interpreter,
+               int              argc,
+               CRB_Value       *args)
+{
+    CRB_Value value;
+
+    DBG_assert(argc == 2, "argument miss match");
+    CRB_TypedArray *left = typed_array_arg(&args[0]);
+    CRB_TypedArray *right = typed_array_arg(&args[1]);
+    check_same_shape(interpreter, left, right);
+    if (left->element_type == CRB_INT_ELEMENT) {
+        value.type = CRB_INT_VALUE;
+        value.u.int_value = crb_numeric_kernels()->dot_int(left->u.int_element,
+                                                          right->u.int_element, left->size);
+    }
+    else {
+        value.type = CRB_DOUBLE_VALUE;
+        value.u.double_value = crb_numeric_kernels()->dot_double(left->u.double_element,
+                                                                right->u.double_element, left->size);
+    }
+    return value;
+}
+
+/**
+ * scale(a, k), 把每个元素乘以 k, 返回 null. int 数组只能乘以 int
+ */
+CRB_Value
+crb_native_scale(CRB_Interpreter *interpreter,
+                 int              argc,
+                 CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 2, "argument miss match");
+    CRB_TypedArray *array = typed_array_arg(&args[0]);
+    if (array->element_type == CRB_INT_ELEMENT) {
+        crb_numeric_kernels()->scale_int(array->u.int_element, array->size,
+                                         int_arg(interpreter, &args[1]));
+    }
+    else {
+        crb_numeric_kernels()->scale_double(array->u.double_element, array->size,
+                                            number_arg(&args[1]));
+    }
+    return value;
+}
+
+/**
+ * fill(a, v), 把每个元素设为 v, 返回 null. int 数组只能填 int
+ */
+CRB_Value
+crb_native_fill(CRB_Interpreter *interpreter,
+                int              argc,
+                CRB_Value       *args)
+{
+    CRB_Value value = { .type = CRB_NULL_VALUE };
+
+    DBG_assert(argc == 2, "argument miss match");
+    CRB_TypedArray *array = typed_array_arg(&args[0]);
+    if (array->element_type == CRB_INT_ELEMENT) {
+        crb_numeric_kernels()->fill_int(array->u.int_element, array->size,
+                                        int_arg(interpreter, &args[1]));
+    }
+    else {
+        crb_numeric_kernels()->fill_double(array->u.double_element, array->size,
+                                           number_arg(&args[1]));
+    }
+    return value;
+}
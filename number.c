@@ -0,0 +1,190 @@
+/**
+ * number.c
+ * 与 locale 无关的数值解析, 词法分析器和 parse_int/parse_double 内置函数共用.
+ */
+
+// strtod_l
+#define _GNU_SOURCE
+
+#include "crowbar.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <locale.h>
+
+// 十进制有效数字超过这个数量时 uint64_t 可能溢出
+#define MAX_FAST_DIGITS (19)
+
+// 不超过 2^53 的整数可以精确地表示为 double
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+
+// 10^0 ~ 10^22 都可以精确地表示为 double
+static const double st_exact_power_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#define MAX_EXACT_POWER (22)
+
+static inline int
+is_digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+CRB_Boolean
+crb_parse_int(const char *str, int len, int *result)
+{
+    int i = 0;
+    CRB_Boolean negative = CRB_FALSE;
+    if (i < len && (str[i] == '+' || str[i] == '-')) {
+        negative = (str[i] == '-') ? CRB_TRUE : CRB_FALSE;
+        i++;
+    }
+    if (i == len) {
+        return CRB_FALSE;
+    }
+
+    // 在负数范围内累加, 这样 INT_MIN 也能正确解析
+    int64_t value = 0;
+    for (; i < len; i++) {
+        if (!is_digit(str[i])) {
+            return CRB_FALSE;
+        }
+        value = value * 10 - (str[i] - '0');
+        if (value < INT_MIN) {
+            return CRB_FALSE;
+        }
+    }
+    if (!negative) {
+        value = -value;
+        if (value > INT_MAX) {
+            return CRB_FALSE;
+        }
+    }
+
+    *result = (int)value;
+    return CRB_TRUE;
+}
+
+/**
+ * 慢速路径: 交给 C locale 下的 strtod_l, 保证正确舍入
+ */
+static double
+parse_double_slow(const char *str, int len)
+{
+    static locale_t c_locale = (locale_t)0;
+    if (c_locale == (locale_t)0) {
+        c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+    }
+
+    char buf[LINE_BUF_SIZE];
+    char *copy = (len < LINE_BUF_SIZE) ? buf : MEM_malloc(len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    double value = strtod_l(copy, NULL, c_locale);
+    if (copy != buf) {
+        MEM_free(copy);
+    }
+    return value;
+}
+
+/**
+ * 格式: [+-]digits[.digits][(e|E)[+-]digits], 小数点两侧至少有一个数字.
+ * 快速路径 (Clinger): 有效数字不超过 2^53 且十进制指数在 ±22 以内时,
+ * 尾数和 10 的幂都能精确表示, 一次乘除法的结果就是正确舍入的.
+ */
+CRB_Boolean
+crb_parse_double(const char *str, int len, double *result)
+{
+    int i = 0;
+    CRB_Boolean negative = CRB_FALSE;
+    if (i < len && (str[i] == '+' || str[i] == '-')) {
+        negative = (str[i] == '-') ? CRB_TRUE : CRB_FALSE;
+        i++;
+    }
+
+    uint64_t mantissa = 0;
+    int digit_num = 0;     // 有效数字个数 (不含前导零)
+    int exponent = 0;      // 十进制指数
+    int has_digit = 0;
+
+    for (; i < len && is_digit(str[i]); i++) {
+        has_digit = 1;
+        if (digit_num < MAX_FAST_DIGITS) {
+            mantissa = mantissa * 10 + (str[i] - '0');
+            if (mantissa != 0) {
+                digit_num++;
+            }
+        }
+        else {
+            digit_num++;
+            exponent++;
+        }
+    }
+    if (i < len && str[i] == '.') {
+        i++;
+        for (; i < len && is_digit(str[i]); i++) {
+            has_digit = 1;
+            if (digit_num < MAX_FAST_DIGITS) {
+                mantissa = mantissa * 10 + (str[i] - '0');
+                if (mantissa != 0) {
+                    digit_num++;
+                }
+                exponent--;
+            }
+            else {
+                digit_num++;
+            }
+        }
+    }
+    if (!has_digit) {
+        return CRB_FALSE;
+    }
+
+    if (i < len && (str[i] == 'e' || str[i] == 'E')) {
+        i++;
+        int exp_sign = 1;
+        if (i < len && (str[i] == '+' || str[i] == '-')) {
+            exp_sign = (str[i] == '-') ? -1 : 1;
+            i++;
+        }
+        if (i == len) {
+            return CRB_FALSE;
+        }
+        int exp_value = 0;
+        for (; i < len; i++) {
+            if (!is_digit(str[i])) {
+                return CRB_FALSE;
+            }
+            if (exp_value < 100000) {
+                exp_value = exp_value * 10 + (str[i] - '0');
+            }
+        }
+        exponent += exp_sign * exp_value;
+    }
+    if (i != len) {
+        return CRB_FALSE;
+    }
+
+    double value;
+    if (digit_num <= MAX_FAST_DIGITS && mantissa <= MAX_EXACT_MANTISSA
+            && exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER) {
+        value = (double)mantissa;
+        if (exponent < 0) {
+            value /= st_exact_power_of_ten[-exponent];
+        }
+        else {
+            value *= st_exact_power_of_ten[exponent];
+        }
+        if (negative) {
+            value = -value;
+        }
+    }
+    else {
+        value = parse_double_slow(str, len);
+    }
+
+    *result = value;
+    return CRB_TRUE;
+}
@@ -0,0 +1,426 @@
+/**
+ * numeric_kernel.c
+ * 数值数组的批量运算内核, x86 上支持 AVX2 时使用 AVX2 实现, 否则使用标量实现.
+ *
+ * 向量实现每次处理 8 个 int 或 4 个 double, 不足一组的尾部交给标量实现.
+ * 规约运算 (sum/min/max/dot) 先在各个通道中分别累积, 最后再合并通道.
+ */
+
+#include "crowbar.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * 标量实现. int 运算经由 unsigned 进行, 溢出时按 32 位回绕而不是未定义行为
+ */
+static int
+sum_int_scalar(const int *p, int n)
+{
+    unsigned int total = 0;
+    for (int i = 0; i < n; i++) {
+        total += (unsigned int)p[i];
+    }
+    return (int)total;
+}
+
+static double
+sum_double_scalar(const double *p, int n)
+{
+    double total = 0.0;
+    for (int i = 0; i < n; i++) {
+        total += p[i];
+    }
+    return total;
+}
+
+static int
+min_int_scalar(const int *p, int n)
+{
+    int ret = p[0];
+    for (int i = 1; i < n; i++) {
+        ret = min(ret, p[i]);
+    }
+    return ret;
+}
+
+static double
+min_double_scalar(const double *p, int n)
+{
+    double ret = p[0];
+    for (int i = 1; i < n; i++) {
+        ret = min(ret, p[i]);
+    }
+    return ret;
+}
+
+static int
+max_int_scalar(const int *p, int n)
+{
+    int ret = p[0];
+    for (int i = 1; i < n; i++) {
+        ret = max(ret, p[i]);
+    }
+    return ret;
+}
+
+static double
+max_double_scalar(const double *p, int n)
+{
+    double ret = p[0];
+    for (int i = 1; i < n; i++) {
+        ret = max(ret, p[i]);
+    }
+    return ret;
+}
+
+static int
+dot_int_scalar(const int *a, const int *b, int n)
+{
+    unsigned int total = 0;
+    for (int i = 0; i < n; i++) {
+        total += (unsigned int)a[i] * (unsigned int)b[i];
+    }
+    return (int)total;
+}
+
+static double
+dot_double_scalar(const double *a, const double *b, int n)
+{
+    double total = 0.0;
+    for (int i = 0; i < n; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+static void
+scale_int_scalar(int *p, int n, int k)
+{
+    for (int i = 0; i < n; i++) {
+        p[i] = (int)((unsigned int)p[i] * (unsigned int)k);
+    }
+}
+
+static void
+scale_double_scalar(double *p, int n, double k)
+{
+    for (int i = 0; i < n; i++) {
+        p[i] *= k;
+    }
+}
+
+static void
+add_int_scalar(int *dest, const int *src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        dest[i] = (int)((unsigned int)dest[i] + (unsigned int)src[i]);
+    }
+}
+
+static void
+add_double_scalar(double *dest, const double *src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        dest[i] += src[i];
+    }
+}
+
+static void
+fill_int_scalar(int *p, int n, int v)
+{
+    for (int i = 0; i < n; i++) {
+        p[i] = v;
+    }
+}
+
+static void
+fill_double_scalar(double *p, int n, double v)
+{
+    for (int i = 0; i < n; i++) {
+        p[i] = v;
+    }
+}
+
+static const NumericKernels st_scalar_kernels = {
+    .sum_int      = sum_int_scalar,
+    .sum_double   = sum_double_scalar,
+    .min_int      = min_int_scalar,
+    .min_double   = min_double_scalar,
+    .max_int      = max_int_scalar,
+    .max_double   = max_double_scalar,
+    .dot_int      = dot_int_scalar,
+    .dot_double   = dot_double_scalar,
+    .scale_int    = scale_int_scalar,
+    .scale_double = scale_double_scalar,
+    .add_int      = add_int_scalar,
+    .add_double   = add_double_scalar,
+    .fill_int     = fill_int_scalar,
+    .fill_double  = fill_double_scalar,
+};
+
+#ifdef USE_X86_SIMD
+#define INT_LANES    (8)
+#define DOUBLE_LANES (4)
+
+/**
+ * 合并通道. 通道数很少, 存回内存逐个合并即可
+ */
+__attribute__((target("avx2")))
+static int
+reduce_add_int(__m256i v)
+{
+    int lane[INT_LANES];
+    _mm256_storeu_si256((__m256i *)lane, v);
+    return sum_int_scalar(lane, INT_LANES);
+}
+
+__attribute__((target("avx2")))
+static double
+reduce_add_double(__m256d v)
+{
+    double lane[DOUBLE_LANES];
+    _mm256_storeu_pd(lane, v);
+    return sum_double_scalar(lane, DOUBLE_LANES);
+}
+
+__attribute__((target("avx2")))
+static int
+sum_int_avx2(const int *p, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i;
+    for (i = 0; i + INT_LANES <= n; i += INT_LANES) {
+        acc = _mm256_add_epi32(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+    }
+    return (int)((unsigned int)reduce_add_int(acc) + (unsigned int)sum_int_scalar(p + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static double
+sum_double_avx2(const double *p, int n)
+{
+    __m256d acc = _mm256_setzero_pd();
+    int i;
+    for (i = 0; i + DOUBLE_LANES <= n; i += DOUBLE_LANES) {
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(p + i));
+    }
+    return reduce_add_double(acc) + sum_double_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int
+min_int_avx2(const int *p, int n)
+{
+    if (n < INT_LANES) {
+        return min_int_scalar(p, n);
+    }
+    __m256i acc = _mm256_loadu_si256((const __m256i *)p);
+    int i;
+    for (i = INT_LANES; i + INT_LANES <= n; i += INT_LANES) {
+        acc = _mm256_min_epi32(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+    }
+    int lane[INT_LANES];
+    _mm256_storeu_si256((__m256i *)lane, acc);
+    int ret = min_int_scalar(lane, INT_LANES);
+    return (i < n) ? min(ret, min_int_scalar(p + i, n - i)) : ret;
+}
+
+__attribute__((target("avx2")))
+static double
+min_double_avx2(const double *p, int n)
+{
+    if (n < DOUBLE_LANES) {
+        return min_double_scalar(p, n);
+    }
+    __m256d acc = _mm256_loadu_pd(p);
+    int i;
+    for (i = DOUBLE_LANES; i + DOUBLE_LANES <= n; i += DOUBLE_LANES) {
+        acc = _mm256_min_pd(acc, _mm256_loadu_pd(p + i));
+    }
+    double lane[DOUBLE_LANES];
+    _mm256_storeu_pd(lane, acc);
+    double ret = min_double_scalar(lane, DOUBLE_LANES);
+    return (i < n) ? min(ret, min_double_scalar(p + i, n - i)) : ret;
+}
+
+__attribute__((target("avx2")))
+static int
+max_int_avx2(const int *p, int n)
+{
+    if (n < INT_LANES) {
+        return max_int_scalar(p, n);
+    }
+    __m256i acc = _mm256_loadu_si256((const __m256i *)p);
+    int i;
+    for (i = INT_LANES; i + INT_LANES <= n; i += INT_LANES) {
+        acc = _mm256_max_epi32(acc, _mm256_loadu_si256((const __m256i *)(p + i)));
+    }
+    int lane[INT_LANES];
+    _mm256_storeu_si256((__m256i *)lane, acc);
+    int ret = max_int_scalar(lane, INT_LANES);
+    return (i < n) ? max(ret, max_int_scalar(p + i, n - i)) : ret;
+}
+
+__attribute__((target("avx2")))
+static double
+max_double_avx2(const double *p, int n)
+{
+    if (n < DOUBLE_LANES) {
+        return max_double_scalar(p, n);
+    }
+    __m256d acc = _mm256_loadu_pd(p);
+    int i;
+    for (i = DOUBLE_LANES; i + DOUBLE_LANES <= n; i += DOUBLE_LANES) {
+        acc = _mm256_max_pd(acc, _mm256_loadu_pd(p + i));
+    }
+    double lane[DOUBLE_LANES];
+    _mm256_storeu_pd(lane, acc);
+    double ret = max_double_scalar(lane, DOUBLE_LANES);
+    return (i < n) ? max(ret, max_double_scalar(p + i, n - i)) : ret;
+}
+
+__attribute__((target("avx2")))
+static int
+dot_int_avx2(const int *a, const int *b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i;
+    for (i = 0; i + INT_LANES <= n; i += INT_LANES) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(va, vb));
+    }
+    return (int)((unsigned int)reduce_add_int(acc)
+                 + (unsigned int)dot_int_scalar(a + i, b + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static double
+dot_double_avx2(const double *a, const double *b, int n)
+{
+    __m256d acc = _mm256_setzero_pd();
+    int i;
+    for (i = 0; i + DOUBLE_LANES <= n; i += DOUBLE_LANES) {
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    return reduce_add_double(acc) + dot_double_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void
+scale_int_avx2(int *p, int n, int k)
+{
+    const __m256i vk = _mm256_set1_epi32(k);
+    int i;
+    for (i = 0; i + INT_LANES <= n; i += INT_LANES) {
+        __m256i *pos = (__m256i *)(p + i);
+        _mm256_storeu_si256(pos, _mm256_mullo_epi32(_mm256_loadu_si256(pos), vk));
+    }
+    scale_int_scalar(p + i, n - i, k);
+}
+
+__attribute__((target("avx2")))
+static void
+scale_double_avx2(double *p, int n, double k)
+{
+    const __m256d vk = _mm256_set1_pd(k);
+    int i;
+    for (i = 0; i + DOUBLE_LANES <= n; i += DOUBLE_LANES) {
+        _mm256_storeu_pd(p + i, _mm256_mul_pd(_mm256_loadu_pd(p + i), vk));
+    }
+    scale_double_scalar(p + i, n - i, k);
+}
+
+__attribute__((target("avx2")))
+static void
+add_int_avx2(int *dest, const int *src, int n)
+{
+    int i;
+    for (i = 0; i + INT_LANES <= n; i += INT_LANES) {
+        __m256i *pos = (__m256i *)(dest + i);
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256(pos, _mm256_add_epi32(_mm256_loadu_si256(pos), v));
+    }
+    add_int_scalar(dest + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void
+add_double_avx2(double *dest, const double *src, int n)
+{
+    int i;
+    for (i = 0; i + DOUBLE_LANES <= n; i += DOUBLE_LANES) {
+        _mm256_storeu_pd(dest + i, _mm256_add_pd(_mm256_loadu_pd(dest + i), _mm256_loadu_pd(src + i)));
+    }
+    add_double_scalar(dest + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void
+fill_int_avx2(int *p, int n, int v)
+{
+    const __m256i vv = _mm256_set1_epi32(v);
+    int i;
+    for (i = 0; i + INT_LANES <= n; i += INT_LANES) {
+        _mm256_storeu_si256((__m256i *)(p + i), vv);
+    }
+    fill_int_scalar(p + i, n - i, v);
+}
+
+__attribute__((target("avx2")))
+static void
+fill_double_avx2(double *p, int n, double v)
+{
+    const __m256d vv = _mm256_set1_pd(v);
+    int i;
+    for (i = 0; i + DOUBLE_LANES <= n; i += DOUBLE_LANES) {
+        _mm256_storeu_pd(p + i, vv);
+    }
+    fill_double_scalar(p + i, n - i, v);
+}
+
+static const NumericKernels st_avx2_kernels = {
+    .sum_int      = sum_int_avx2,
+    .sum_double   = sum_double_avx2,
+    .min_int      = min_int_avx2,
+    .min_double   = min_double_avx2,
+    .max_int      = max_int_avx2,
+    .max_double   = max_double_avx2,
+    .dot_int      = dot_int_avx2,
+    .dot_double   = dot_double_avx2,
+    .scale_int    = scale_int_avx2,
+    .scale_double = scale_double_avx2,
+    .add_int      = add_int_avx2,
+    .add_double   = add_double_avx2,
+    .fill_int     = fill_int_avx2,
+    .fill_double  = fill_double_avx2,
+};
+#endif // USE_X86_SIMD
+
+static const NumericKernels *st_numeric_kernels = NULL;
+
+// 首次调用时根据 CPU 特性选择内核
+static const NumericKernels *
+select_kernels()
+{
+    const NumericKernels *kernels = &st_scalar_kernels;
+#ifdef USE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = &st_avx2_kernels;
+    }
+#endif
+    return kernels;
+}
+
+const NumericKernels *
+crb_numeric_kernels()
+{
+    if (st_numeric_kernels == NULL) {
+        st_numeric_kernels = select_kernels();
+    }
+    return st_numeric_kernels;
+}
@@ -0,0 +1,107 @@
+/**
+ * record.c
+ * 记录与形状.
+ *
+ * 记录的字段集合在构造时确定, 之后只能读写已有字段.
+ * 字段值不保存名字, 按形状中的顺序连续存放, 名字到下标的映射由形状负责,
+ * 同一形状的所有记录共享它. 字段访问点缓存 (形状, 下标),
+ * 形状命中时访问字段只需一次指针比较和一次下标运算.
+ */
+
+#include "crowbar.h"
+#include "DBG.h"
+#include <string.h>
+
+RecordShape *
+crb_search_shape(CRB_Interpreter *interpreter, int field_count, const char **field_name)
+{
+    for (RecordShape *pos = interpreter->shape_list; pos != NULL; pos = pos->next) {
+        if (pos->field_count != field_count) {
+            continue;
+        }
+        int i;
+        for (i = 0; i < field_count; i++) {
+            if (strcmp(pos->field_name[i], field_name[i])) {
+                break;
+            }
+        }
+        if (i == field_count) {
+            return pos;
+        }
+    }
+
+    // 形状与解释器同生命周期, 分配在解释器存储器中
+    RecordShape *shape = MEM_storage_malloc(interpreter->interpreter_storage, sizeof(RecordShape));
+    shape->field_count = field_count;
+    shape->field_name = MEM_storage_malloc(interpreter->interpreter_storage,
+                                           sizeof(const char *) * field_count);
+    memcpy(shape->field_name, field_name, sizeof(const char *) * field_count);
+    shape->next = interpreter->shape_list;
+    interpreter->shape_list = shape;
+    return shape;
+}
+
+int
+crb_shape_field_index(RecordShape *shape, const char *name)
+{
+    for (int i = 0; i < shape->field_count; i++) {
+        if (!strcmp(shape->field_name[i], name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+CRB_Record *
+crb_create_record(CRB_Interpreter *interpreter, RecordShape *shape)
+{
+    CRB_Record *record = MEM_malloc(sizeof(CRB_Record) + sizeof(CRB_Value) * shape->field_count);
+    record->header.type = CRB_RECORD_VALUE;
+    record->header.ref_count = 1;
+    record->header.marked = CRB_FALSE;  // 由回收器登记时设置
+    record->header.gc_next = NULL;
+    record->shape = shape;
+    // 填写字段期间可能经过安全点, 回收器会遍历所有字段
+    for (int i = 0; i < shape->field_count; i++) {
+        record->field[i].type = CRB_NULL_VALUE;
+    }
+    if (interpreter->gc.enabled) {
+        crb_gc_register_container(interpreter, &record->header, crb_record_bytes(record));
+    }
+    return record;
+}
+
+void
+crb_refer_record(CRB_Record *record)
+{
+    if (!crb_get_current_interpreter()->gc.enabled) {
+        record->header.ref_count++;
+    }
+}
+
+void
+crb_dispose_record(CRB_Record *record)
+{
+    MEM_free(record);
+}
+
+void
+crb_release_record(CRB_Record *record)
+{
+    if (crb_get_current_interpreter()->gc.enabled) {
+        return;
+    }
+
+    record->header.ref_count--;
+    DBG_assert(record->header.ref_count >= 0, "ref count < 0");
+
+    if (record->header.ref_count == 0) {
+        crb_release_container(&record->header);
+    }
+}
+
+size_t
+crb_record_bytes(CRB_Record *record)
+{
+    return sizeof(CRB_Record) + sizeof(CRB_Value) * record->shape->field_count;
+}
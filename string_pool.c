@@ -1,17 +1,82 @@
 #include "crowbar.h"
 #include "DBG.h"
+#include <string.h>
+
+// 可以内联存放在 slab 块中的字符串长度上限 (含结尾的 '\0')
+#define SHORT_STRING_SIZE (40)
+
+// 每次补充空闲链表时切出的 slab 块数量
+#define STRING_SLAB_CHUNK_NUM (64)
+
+// 原地追加时缓冲区的增长倍数
+#define STRING_GROWTH_FACTOR (2)
+
+/**
+ * slab 块: 空闲时作为链表结点, 分配后作为 CRB_String 头部加上内联的短字符串缓冲区.
+ * 这样短字符串只需要一次分配, 释放时也只是放回空闲链表.
+ */
+union StringChunk_tag {
+    struct {
+        CRB_String header;
+        char       body[SHORT_STRING_SIZE];
+    } s;
+    StringChunk *next;
+};
 
 /**
- * 在存储器以外的空间分配 CRB_String, 字符串采用浅拷贝,
+ * 从当前解释器的空闲链表取出一个 slab 块.
+ * 空闲链表为空时从解释器存储器中切出一批新的块,
+ * 它们与解释器同生命周期, 不会单独归还.
+ */
+static StringChunk *alloc_chunk()
+{
+    CRB_Interpreter *interpreter = crb_get_current_interpreter();
+
+    if (interpreter->string_free_list == NULL) {
+        StringChunk *slab = MEM_storage_malloc(interpreter->interpreter_storage,
+                                               sizeof(StringChunk) * STRING_SLAB_CHUNK_NUM);
+        for (int i = 0; i < STRING_SLAB_CHUNK_NUM; i++) {
+            slab[i].next = interpreter->string_free_list;
+            interpreter->string_free_list = &slab[i];
+        }
+    }
+
+    StringChunk *chunk = interpreter->string_free_list;
+    interpreter->string_free_list = chunk->next;
+    return chunk;
+}
+
+static void free_chunk(StringChunk *chunk)
+{
+    CRB_Interpreter *interpreter = crb_get_current_interpreter();
+    chunk->next = interpreter->string_free_list;
+    interpreter->string_free_list = chunk;
+}
+
+/**
+ * 在 slab 中分配 CRB_String, 字符串采用浅拷贝,
  * 这样在引用计数为 0 时能够将其删除. 如果是分配在存储器中,
  * 则不能即时回收. 但是不分配在存储器中, 则存在泄露的风险.
  */
 static CRB_String *alloc_crb_string(char *str, CRB_Boolean is_literal)
 {
-    CRB_String *ret = MEM_malloc(sizeof(CRB_String));
+    CRB_Interpreter *interpreter = crb_get_current_interpreter();
+    CRB_String *ret = &alloc_chunk()->s.header;
     ret->ref_count = 0;
     ret->is_literal = is_literal;
+    ret->is_interned = CRB_FALSE;
+    ret->is_scratch = CRB_FALSE;
+    ret->hash = 0;
+    ret->intern_next = NULL;
+    ret->parent = NULL;
     ret->string = str;
+    ret->length = (str != NULL) ? strlen(str) : 0;
+    ret->capacity = ret->length;
+    ret->marked = CRB_FALSE;  // 由回收器登记时设置
+    ret->gc_next = NULL;
+    if (interpreter->gc.enabled) {
+        crb_gc_register_string(interpreter, ret, sizeof(StringChunk));
+    }
     return ret;
 }
 
@@ -25,28 +90,245 @@ CRB_String *crb_literal_to_crb_string(char *str)
     return ret;
 }
 
+/**
+ * 驻留表相关.
+ * 表是弱引用的: 登记的字符串不增加引用计数, 在 crb_release_string 释放时摘除,
+ * 所以表中永远不会有悬空指针.
+ */
+#define INTERN_TABLE_INIT_SIZE (64)
+
+static void remove_interned_string(CRB_String *str)
+{
+    InternTable *table = &crb_get_current_interpreter()->intern_table;
+    CRB_String **pos = &table->bucket[str->hash % table->bucket_num];
+    while (*pos != str) {
+        pos = &(*pos)->intern_next;
+    }
+    *pos = str->intern_next;
+    table->count--;
+}
+
+// 装载因子超过 1 时桶数量翻倍, 利用缓存的哈希值重新分布
+static void grow_intern_table(InternTable *table)
+{
+    int new_num = (table->bucket_num == 0) ? INTERN_TABLE_INIT_SIZE : table->bucket_num * 2;
+    CRB_String **new_bucket = MEM_malloc(sizeof(CRB_String *) * new_num);
+    memset(new_bucket, 0, sizeof(CRB_String *) * new_num);
+
+    for (int i = 0; i < table->bucket_num; i++) {
+        CRB_String *pos = table->bucket[i];
+        while (pos != NULL) {
+            CRB_String *next = pos->intern_next;
+            pos->intern_next = new_bucket[pos->hash % new_num];
+            new_bucket[pos->hash % new_num] = pos;
+            pos = next;
+        }
+    }
+
+    MEM_free(table->bucket);
+    table->bucket = new_bucket;
+    table->bucket_num = new_num;
+}
+
+// FNV-1a
+unsigned int crb_string_hash(CRB_String *str)
+{
+    if (str->hash == 0) {
+        unsigned int hash = 2166136261u;
+        const unsigned char *p = (const unsigned char *)str->string;
+        for (int i = 0; i < str->length; i++) {
+            hash = (hash ^ p[i]) * 16777619u;
+        }
+        str->hash = (hash == 0) ? 1 : hash;
+    }
+    return str->hash;
+}
+
+CRB_String *crb_intern_string(CRB_String *str)
+{
+    DBG_assert(!str->is_scratch, "scratch string cannot be interned");
+    if (str->is_interned) {
+        return str;
+    }
+
+    InternTable *table = &crb_get_current_interpreter()->intern_table;
+    unsigned int hash = crb_string_hash(str);
+
+    if (table->bucket_num > 0) {
+        for (CRB_String *pos = table->bucket[hash % table->bucket_num];
+             pos != NULL; pos = pos->intern_next) {
+            if (pos->hash == hash && pos->length == str->length
+                    && !memcmp(pos->string, str->string, str->length)) {
+                crb_gc_revive_string(crb_get_current_interpreter(), pos);
+                crb_refer_string(pos);
+                crb_release_string(str);
+                return pos;
+            }
+        }
+    }
+
+    // 驻留的字符串可能长期存活, 不应一直钉住父字符串
+    crb_string_to_c(str);
+
+    if (table->count >= table->bucket_num) {
+        grow_intern_table(table);
+    }
+    str->intern_next = table->bucket[hash % table->bucket_num];
+    table->bucket[hash % table->bucket_num] = str;
+    str->is_interned = CRB_TRUE;
+    table->count++;
+
+    return str;
+}
+
+CRB_String *crb_auto_intern_string(CRB_String *str)
+{
+    if (crb_get_current_interpreter()->intern_on_create) {
+        str = crb_intern_string(str);
+    }
+    return str;
+}
+
+// 开启回收器后字符串的生命周期由回收器决定, 引用计数操作都是空操作
 void crb_refer_string(CRB_String *str)
 {
-    str->ref_count++;
+    if (!str->is_scratch && !crb_get_current_interpreter()->gc.enabled) {
+        str->ref_count++;
+    }
 }
 
 /**
  * 如果不是字面量, 则会释放掉字符串.
  * 字面量在词法分析时构建, 为字符串类型表达式语法结点拥有.
+ * 内联在 slab 块中的字符串随块一起归还.
  */
+void crb_dispose_string(CRB_String *str)
+{
+    StringChunk *chunk = (StringChunk *)str;
+    if (str->is_interned) {
+        remove_interned_string(str);
+    }
+    if (str->parent == NULL && str->is_literal == CRB_FALSE && str->string != chunk->s.body) {
+        MEM_free(str->string);
+    }
+    free_chunk(chunk);
+}
+
+// 字符串占用的字节数: slab 块, 加上自己拥有的缓冲区
+size_t crb_string_bytes(CRB_String *str)
+{
+    size_t bytes = sizeof(StringChunk);
+    if (str->parent == NULL && str->is_literal == CRB_FALSE
+            && str->string != ((StringChunk *)str)->s.body) {
+        bytes += str->capacity + 1;
+    }
+    return bytes;
+}
+
 void crb_release_string(CRB_String *str)
 {
+    if (str->is_scratch || crb_get_current_interpreter()->gc.enabled) {
+        return;
+    }
+
     str->ref_count--;
     DBG_assert(str->ref_count >= 0, "ref count < 0");
 
     if (str->ref_count == 0) {
-        if (str->is_literal == CRB_FALSE) {
-            MEM_free(str->string);
+        CRB_String *parent = str->parent;
+        crb_dispose_string(str);
+        if (parent != NULL) {
+            crb_release_string(parent);
         }
-        MEM_free(str);
+    }
+}
+
+void crb_refer_value(CRB_Value *value)
+{
+    if (value->type == CRB_STRING_VALUE) {
+        crb_refer_string(value->u.string_value);
+    }
+    else if (value->type == CRB_ARRAY_VALUE) {
+        crb_refer_array(value->u.array_value);
+    }
+    else if (value->type == CRB_MAP_VALUE) {
+        crb_refer_map(value->u.map_value);
+    }
+    else if (value->type == CRB_TYPED_ARRAY_VALUE) {
+        crb_refer_typed_array(value->u.typed_array_value);
+    }
+    else if (value->type == CRB_RECORD_VALUE) {
+        crb_refer_record(value->u.record_value);
+    }
+}
+
+void crb_release_value(CRB_Value *value)
+{
+    if (value->type == CRB_STRING_VALUE) {
+        crb_release_string(value->u.string_value);
+    }
+    else if (value->type == CRB_ARRAY_VALUE) {
+        crb_release_array(value->u.array_value);
+    }
+    else if (value->type == CRB_MAP_VALUE) {
+        crb_release_map(value->u.map_value);
+    }
+    else if (value->type == CRB_TYPED_ARRAY_VALUE) {
+        crb_release_typed_array(value->u.typed_array_value);
+    }
+    else if (value->type == CRB_RECORD_VALUE) {
+        crb_release_record(value->u.record_value);
     }
 }
 
+/**
+ * 容器先挂到待释放链表上 (经 gc_next 串起, 引用计数模式下回收器不使用它),
+ * 由最外层的调用逐个释放元素并回收. 释放元素时降为 0 的容器同样只是挂到链表上,
+ * 所以释放嵌套很深的容器不会递归
+ */
+void crb_release_container(CRB_Object *container)
+{
+    CRB_Interpreter *interpreter = crb_get_current_interpreter();
+
+    container->gc_next = interpreter->release_list;
+    interpreter->release_list = container;
+    if (interpreter->releasing) {
+        return;
+    }
+
+    interpreter->releasing = CRB_TRUE;
+    while (interpreter->release_list != NULL) {
+        container = interpreter->release_list;
+        interpreter->release_list = container->gc_next;
+
+        if (container->type == CRB_ARRAY_VALUE) {
+            CRB_Array *array = (CRB_Array *)container;
+            for (int i = 0; i < array->size; i++) {
+                crb_release_value(&array->element[i]);
+            }
+            crb_dispose_array(array);
+        }
+        else if (container->type == CRB_MAP_VALUE) {
+            CRB_Map *map = (CRB_Map *)container;
+            for (int i = 0; i < map->capacity; i++) {
+                if (map->entry[i].distance != 0) {
+                    crb_release_value(&map->entry[i].key);
+                    crb_release_value(&map->entry[i].value);
+                }
+            }
+            crb_dispose_map(map);
+        }
+        else if (container->type == CRB_RECORD_VALUE) {
+            CRB_Record *record = (CRB_Record *)container;
+            for (int i = 0; i < record->shape->field_count; i++) {
+                crb_release_value(&record->field[i]);
+            }
+            crb_dispose_record(record);
+        }
+    }
+    interpreter->releasing = CRB_FALSE;
+}
+
 /**
  * 对应于 crb_literal_to_crb_string, 这个函数用来构造非字面量 CRB_String
  */
@@ -55,4 +337,149 @@ CRB_String *crb_create_crb_string(char *str)
     CRB_String *ret = alloc_crb_string(str, CRB_FALSE);
     ret->ref_count = 1;
     return ret;
-}
\ No newline at end of file
+}
+
+/**
+ * 短字符串直接使用 slab 块的内联缓冲区, 长字符串另外申请
+ */
+CRB_String *crb_alloc_crb_string(size_t len)
+{
+    CRB_String *ret = alloc_crb_string(NULL, CRB_FALSE);
+    ret->ref_count = 1;
+    ret->length = len;
+    if (len < SHORT_STRING_SIZE) {
+        ret->string = ((StringChunk *)ret)->s.body;
+        ret->capacity = SHORT_STRING_SIZE - 1;
+    }
+    else {
+        CRB_Interpreter *interpreter = crb_get_current_interpreter();
+        ret->string = MEM_malloc(len + 1);
+        ret->capacity = len;
+        if (interpreter->gc.enabled) {
+            crb_gc_add_bytes(interpreter, len + 1);
+        }
+    }
+    return ret;
+}
+
+CRB_String *crb_copy_crb_string(const char *str)
+{
+    size_t len = strlen(str);
+    CRB_String *ret = crb_alloc_crb_string(len);
+    memcpy(ret->string, str, len + 1);
+    return ret;
+}
+
+/**
+ * 头部与缓冲区一起从临时区中切出, 不经过 slab 和回收器
+ */
+CRB_String *crb_alloc_scratch_string(CRB_Interpreter *interpreter, size_t len)
+{
+    CRB_String *ret = MEM_storage_malloc(interpreter->scratch_storage,
+                                         sizeof(CRB_String) + len + 1);
+    ret->ref_count = 1;
+    ret->string = (char *)(ret + 1);
+    ret->length = len;
+    ret->capacity = len;
+    ret->parent = NULL;
+    ret->is_literal = CRB_FALSE;
+    ret->is_interned = CRB_FALSE;
+    ret->is_scratch = CRB_TRUE;
+    ret->hash = 0;
+    ret->intern_next = NULL;
+    ret->marked = CRB_FALSE;
+    ret->gc_next = NULL;
+    return ret;
+}
+
+/**
+ * 视图总是直接引用拥有缓冲区的字符串, 不会形成视图链.
+ * 拷贝短子串与创建视图一样只需一个 slab 块, 却不会钉住父字符串, 所以短子串直接拷贝.
+ */
+CRB_String *crb_create_string_view(CRB_String *parent, int offset, int length)
+{
+    DBG_assert(offset >= 0 && length >= 0 && offset + length <= parent->length,
+               "bad view range");
+
+    if (length < SHORT_STRING_SIZE) {
+        CRB_String *ret = crb_alloc_crb_string(length);
+        memcpy(ret->string, parent->string + offset, length);
+        ret->string[length] = '\0';
+        return ret;
+    }
+
+    CRB_String *ret = alloc_crb_string(NULL, CRB_FALSE);
+    ret->ref_count = 1;
+    ret->string = parent->string + offset;
+    ret->length = length;
+    ret->parent = (parent->parent != NULL) ? parent->parent : parent;
+    crb_refer_string(ret->parent);
+    return ret;
+}
+
+/**
+ * 在 str 末尾原地追加 len 个字符, 无法原地修改时返回 CRB_FALSE, 由调用者另建新字符串.
+ * 只有唯一持有者的普通字符串可以修改: 字面量的缓冲区属于语法树, 视图与父字符串共享缓冲区,
+ * 驻留字符串可能经由驻留表被再次取得, 临时区和回收器中的字符串不维护引用计数.
+ * 缓冲区不足时按倍数扩大, 反复追加的均摊代价与追加的长度成正比.
+ */
+CRB_Boolean crb_append_string_in_place(CRB_String *str, const char *chars, int len)
+{
+    CRB_Interpreter *interpreter = crb_get_current_interpreter();
+
+    if (str->ref_count != 1 || str->is_literal || str->parent != NULL || str->is_interned
+            || str->is_scratch || interpreter->gc.enabled) {
+        return CRB_FALSE;
+    }
+
+    int new_length = str->length + len;
+    if (new_length > str->capacity) {
+        int new_capacity = max(new_length, str->capacity * STRING_GROWTH_FACTOR);
+        if (str->string == ((StringChunk *)str)->s.body) {
+            char *buf = MEM_malloc(new_capacity + 1);
+            memcpy(buf, str->string, str->length);
+            str->string = buf;
+        }
+        else {
+            str->string = MEM_realloc(str->string, new_capacity + 1);
+        }
+        str->capacity = new_capacity;
+    }
+    memcpy(str->string + str->length, chars, len);
+    str->length = new_length;
+    str->string[new_length] = '\0';
+    str->hash = 0;
+    return CRB_TRUE;
+}
+
+/**
+ * 实体化视图: 拷贝出独立的缓冲区, 然后释放对父字符串的引用
+ */
+const char *crb_string_to_c(CRB_String *str)
+{
+    if (str->parent != NULL) {
+        CRB_String *parent = str->parent;
+        CRB_Interpreter *interpreter = crb_get_current_interpreter();
+        char *buf = MEM_malloc(str->length + 1);
+        if (interpreter->gc.enabled) {
+            crb_gc_add_bytes(interpreter, str->length + 1);
+        }
+        memcpy(buf, str->string, str->length);
+        buf[str->length] = '\0';
+        str->string = buf;
+        str->capacity = str->length;
+        str->parent = NULL;
+        crb_release_string(parent);
+    }
+    return str->string;
+}
+
+int crb_compare_string(CRB_String *left, CRB_String *right)
+{
+    int len = min(left->length, right->length);
+    int cmp = memcmp(left->string, right->string, len);
+    if (cmp == 0) {
+        cmp = left->length - right->length;
+    }
+    return cmp;
+}
@@ -0,0 +1,127 @@
+/**
+ * string_search.c
+ * 字符串查找的内核函数, x86 上按 CPU 特性选择 AVX2/SSE2 实现, 其余平台使用标量实现.
+ *
+ * 向量实现的思路: 同时比较模式串的首字符与尾字符,
+ * 一次筛选出 16/32 个候选位置, 只对两端都匹配的候选位置做完整比较.
+ */
+
+#include "crowbar.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+typedef int (*SearchKernel)(const char *str, int len, const char *pattern, int pattern_len);
+
+static int
+search_scalar(const char *str, int len, const char *pattern, int pattern_len)
+{
+    const char *end = str + len - pattern_len;
+    for (const char *pos = str; pos <= end; pos++) {
+        pos = memchr(pos, pattern[0], end - pos + 1);
+        if (pos == NULL) {
+            break;
+        }
+        if (!memcmp(pos, pattern, pattern_len)) {
+            return pos - str;
+        }
+    }
+    return -1;
+}
+
+#ifdef USE_X86_SIMD
+__attribute__((target("sse2")))
+static int
+search_sse2(const char *str, int len, const char *pattern, int pattern_len)
+{
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[pattern_len - 1]);
+
+    int i;
+    for (i = 0; i + pattern_len - 1 + 16 <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(str + i + pattern_len - 1));
+        unsigned int mask = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                              _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (!memcmp(str + i + bit, pattern, pattern_len)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    int ret = search_scalar(str + i, len - i, pattern, pattern_len);
+    return (ret < 0) ? -1 : i + ret;
+}
+
+__attribute__((target("avx2")))
+static int
+search_avx2(const char *str, int len, const char *pattern, int pattern_len)
+{
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[pattern_len - 1]);
+
+    int i;
+    for (i = 0; i + pattern_len - 1 + 32 <= len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(str + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(str + i + pattern_len - 1));
+        unsigned int mask = _mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                 _mm256_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (!memcmp(str + i + bit, pattern, pattern_len)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    int ret = search_sse2(str + i, len - i, pattern, pattern_len);
+    return (ret < 0) ? -1 : i + ret;
+}
+#endif // USE_X86_SIMD
+
+static SearchKernel st_search_kernel = NULL;
+
+// 首次调用时根据 CPU 特性选择内核
+static SearchKernel
+select_kernel()
+{
+    SearchKernel kernel = search_scalar;
+#ifdef USE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = search_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        kernel = search_sse2;
+    }
+#endif
+    return kernel;
+}
+
+int
+crb_search_string(CRB_String *str, int from, CRB_String *pattern)
+{
+    if (st_search_kernel == NULL) {
+        st_search_kernel = select_kernel();
+    }
+
+    if (pattern->length == 0) {
+        return (from <= str->length) ? from : -1;
+    }
+    if (from + pattern->length > str->length) {
+        return -1;
+    }
+
+    int ret = st_search_kernel(str->string + from, str->length - from,
+                               pattern->string, pattern->length);
+    return (ret < 0) ? -1 : from + ret;
+}
@@ -0,0 +1,136 @@
+/**
+ * typed_array.c
+ * 数值数组: 元素以 int 或 double 连续存放, 供批量运算内核直接处理.
+ */
+
+#include "crowbar.h"
+#include "DBG.h"
+#include <string.h>
+
+static size_t
+element_size(CRB_ElementType element_type)
+{
+    return (element_type == CRB_INT_ELEMENT) ? sizeof(int) : sizeof(double);
+}
+
+CRB_TypedArray *
+crb_create_typed_array(CRB_Interpreter *interpreter, CRB_ElementType element_type, int size)
+{
+    CRB_TypedArray *array = MEM_malloc(sizeof(CRB_TypedArray));
+    array->header.type = CRB_TYPED_ARRAY_VALUE;
+    array->header.ref_count = 1;
+    array->header.marked = CRB_FALSE;  // 由回收器登记时设置
+    array->header.gc_next = NULL;
+    array->element_type = element_type;
+    array->size = size;
+
+    // int 和 double 的 0 都是全 0 的位模式
+    void *element = NULL;
+    if (size > 0) {
+        element = MEM_malloc(element_size(element_type) * size);
+        memset(element, 0, element_size(element_type) * size);
+    }
+    if (element_type == CRB_INT_ELEMENT) {
+        array->u.int_element = element;
+    }
+    else {
+        array->u.double_element = element;
+    }
+
+    if (interpreter->gc.enabled) {
+        crb_gc_register_container(interpreter, &array->header, crb_typed_array_bytes(array));
+    }
+    return array;
+}
+
+static void
+check_index(CRB_TypedArray *array, int index)
+{
+    if (index < 0 || index >= array->size) {
+        crb_runtime_error(crb_get_current_interpreter()->current_line_number,
+                          "array index %d out of range (size %d)", index, array->size);
+    }
+}
+
+CRB_Value
+crb_typed_array_get(CRB_TypedArray *array, int index)
+{
+    CRB_Value value;
+
+    check_index(array, index);
+    if (array->element_type == CRB_INT_ELEMENT) {
+        value.type = CRB_INT_VALUE;
+        value.u.int_value = array->u.int_element[index];
+    }
+    else {
+        value.type = CRB_DOUBLE_VALUE;
+        value.u.double_value = array->u.double_element[index];
+    }
+    return value;
+}
+
+void
+crb_typed_array_set(CRB_TypedArray *array, int index, CRB_Value *value)
+{
+    int line_number = crb_get_current_interpreter()->current_line_number;
+
+    check_index(array, index);
+    if (array->element_type == CRB_INT_ELEMENT) {
+        if (value->type != CRB_INT_VALUE) {
+            crb_runtime_error(line_number, "int array element must be an int");
+        }
+        array->u.int_element[index] = value->u.int_value;
+    }
+    else {
+        if (value->type == CRB_INT_VALUE) {
+            array->u.double_element[index] = value->u.int_value;
+        }
+        else if (value->type == CRB_DOUBLE_VALUE) {
+            array->u.double_element[index] = value->u.double_value;
+        }
+        else {
+            crb_runtime_error(line_number, "double array element must be a number");
+        }
+    }
+}
+
+void
+crb_refer_typed_array(CRB_TypedArray *array)
+{
+    if (!crb_get_current_interpreter()->gc.enabled) {
+        array->header.ref_count++;
+    }
+}
+
+void
+crb_dispose_typed_array(CRB_TypedArray *array)
+{
+    if (array->element_type == CRB_INT_ELEMENT) {
+        MEM_free(array->u.int_element);
+    }
+    else {
+        MEM_free(array->u.double_element);
+    }
+    MEM_free(array);
+}
+
+void
+crb_release_typed_array(CRB_TypedArray *array)
+{
+    if (crb_get_current_interpreter()->gc.enabled) {
+        return;
+    }
+
+    array->header.ref_count--;
+    DBG_assert(array->header.ref_count >= 0, "ref count < 0");
+
+    if (array->header.ref_count == 0) {
+        crb_dispose_typed_array(array);
+    }
+}
+
+size_t
+crb_typed_array_bytes(CRB_TypedArray *array)
+{
+    return sizeof(CRB_TypedArray) + element_size(array->element_type) * array->size;
+}
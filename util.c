@@ -5,7 +5,9 @@
 
 #include "crowbar.h"
 #include "MEM.h"
+#include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
 static CRB_Interpreter *st_current_interpreter = NULL;
 
@@ -40,18 +42,25 @@ void *crb_execute_malloc(CRB_Interpreter *interpreter,
 }
 
 // 遍历解释器的函数定义链表, 按名字找函数定义指针.
+// 脚本中定义的函数优先于同名的内置函数, 这样新增内置函数不会改变已有脚本的行为.
 // 没有找到的情况下返回 NULL.
 FunctionDefinition *
 crb_search_function(const char *name)
 {
     CRB_Interpreter *interpreter = crb_get_current_interpreter();
-    FunctionDefinition *curr = interpreter->function_list;
-    for (; curr != NULL; curr = curr->next) {
-        if (!strcmp(curr->name, name)) {
-            break;
+    FunctionDefinition *native = NULL;
+    for (FunctionDefinition *curr = interpreter->function_list; curr != NULL; curr = curr->next) {
+        if (strcmp(curr->name, name)) {
+            continue;
+        }
+        if (curr->type == CROWBAR_FUNCTION_DEFINITION) {
+            return curr;
+        }
+        if (native == NULL) {
+            native = curr;
         }
     }
-    return curr;
+    return native;
 }
 
 Variable *crb_search_global(CRB_Interpreter *interpreter,
@@ -66,15 +75,28 @@ Variable *crb_search_global(CRB_Interpreter *interpreter,
 }
 
 /**
- * 注册全局变量一定发生在顶层作用域, 所以不需要 env
+ * 全局变量不需要 env. 函数调用的实参和内置函数中也可能注册全局变量,
+ * 而运行时存储器在函数返回时会回退, 所以全局变量分配在与解释器同生命周期的存储器中
  */
 void CRB_add_global_variable(CRB_Interpreter *interpreter,
                              const char      *identifier,
                              CRB_Value       *value)
 {
-    Variable *new_variable = crb_execute_malloc(interpreter, sizeof(Variable));
+    Variable *new_variable = MEM_storage_malloc(interpreter->interpreter_storage, sizeof(Variable));
     new_variable->name = identifier;
     new_variable->value = *value;
     new_variable->next = interpreter->variable;
     interpreter->variable = new_variable;
 }
+
+void
+crb_runtime_error(int line_number, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "Line %d: ", line_number);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}